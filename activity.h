@@ -0,0 +1,80 @@
+/**
+ * activity.h reduces batches of LIS3DH FIFO samples to the activity score
+ * of a work interval: the sum of sample-to-sample changes and a count of
+ * peaks. The firmware runs it on each FIFO read and tools/activity_replay.cpp
+ * runs it on FIFO dumps recorded from a board, so both compute the same score.
+ * */
+
+#ifndef ACTIVITY_H
+#define ACTIVITY_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+// The FIFO holds up to 32 samples of X, Y and Z as 16-bit little-endian words.
+#define LIS3DH_FIFO_SAMPLES 32
+#define LIS3DH_SAMPLE_BYTES 6
+
+// Output rate the firmware runs the accelerometer at.
+#define ACCEL_ODR_HZ 400
+
+// A change of more than ACTIVITY_PEAK_MG per 10 ms across the three axes
+// counts as a peak; the meter compares it per sample.
+#define ACTIVITY_PEAK_MG 250
+#define ACTIVITY_PEAK_THRESHOLD_MG (ACTIVITY_PEAK_MG * 100 / ACCEL_ODR_HZ)
+
+struct ActivityMeter
+{
+    // Change between two samples, in mg summed over the axes, above which
+    // a peak starts.
+    unsigned long peakThresholdMg;
+
+    int16_t lastAccel[3];
+    bool abovePeak;
+
+    unsigned long sum;
+    unsigned long peakCt;
+
+    void begin(unsigned long thresholdMg)
+    {
+        peakThresholdMg = thresholdMg;
+        for (int axis = 0; axis < 3; axis++)
+            lastAccel[axis] = 0;
+        abovePeak = false;
+        sum = 0;
+        peakCt = 0;
+    }
+
+    // Samples waiting in the FIFO according to its FIFO_SRC register.
+    static int fifoCount(uint8_t fifoSource)
+    {
+        return fifoSource & 0x40 ? LIS3DH_FIFO_SAMPLES : fifoSource & 0x1f;
+    }
+
+    // Fold count samples in. A priming batch, which may hold samples from
+    // before sampling resumed, only sets the starting point.
+    void reduce(const uint8_t *samples, int count, bool priming)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            // High resolution output is 12 bits left justified, 1 mg per bit at 2 g.
+            unsigned long change = 0;
+            for (int axis = 0; axis < 3; axis++)
+            {
+                const uint8_t *bytes = samples + LIS3DH_SAMPLE_BYTES * i + 2 * axis;
+                int16_t accel = (int16_t)(bytes[0] | bytes[1] << 8) >> 4;
+                change += abs(accel - lastAccel[axis]);
+                lastAccel[axis] = accel;
+            }
+            if (priming)
+                continue;
+            sum += change;
+            bool above = change > peakThresholdMg;
+            if (above && !abovePeak)
+                peakCt++;
+            abovePeak = above;
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,32 @@
+/**
+ * chimes.h describes the end-of-interval chimes: the two notes each state
+ * starts with and the envelope that shapes them. The firmware plays them and
+ * tools/render_wav.cpp renders them, so both always use the same settings.
+ * */
+
+#ifndef CHIMES_H
+#define CHIMES_H
+
+#include "synth.h"
+
+// Frequencies, sound durations and envelope for end-of-cycle chimes.
+#define PITCH_C3 130
+#define PITCH_E3 164
+#define PITCH_G3 196
+#define PITCH_B3 247
+#define PITCH_D4 294
+#define SOUND_DURATION_MS 50
+#define SOUND_ATTACK_MS 10
+#define SOUND_DECAY_MS 60
+#define SOUND_SUSTAIN_PERCENT 60
+#define SOUND_RELEASE_MS 400
+
+// One chime per state: work, short break, long break.
+const int sounds[3] = {PITCH_C3, PITCH_E3, PITCH_G3};
+// Second voice of each chime, a fifth above.
+const int harmonies[3] = {PITCH_G3, PITCH_B3, PITCH_D4};
+
+const Envelope chimeEnvelope = {SOUND_ATTACK_MS, SOUND_DECAY_MS,
+                                SYNTH_ENVELOPE_ONE / 100 * SOUND_SUSTAIN_PERCENT, SOUND_RELEASE_MS};
+
+#endif
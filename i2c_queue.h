@@ -0,0 +1,178 @@
+/**
+ * i2c_queue.h runs queued register accesses to one I2C device from the bus
+ * interrupt, so that nobody waits for the bus. It drives the bus through a
+ * small register-access interface: the firmware implements it on a SAMD21
+ * SERCOM and tools/lis3dh_sim.cpp on a simulated LIS3DH.
+ * */
+
+#ifndef I2C_QUEUE_H
+#define I2C_QUEUE_H
+
+#include <stdint.h>
+
+// Interrupt causes, the bits of the SAMD21 SERCOM I2C master INTFLAG register.
+#define I2C_FLAG_MB 0x01
+#define I2C_FLAG_SB 0x02
+#define I2C_FLAG_ERROR 0x80
+
+typedef void (*I2cCallback)(bool ok);
+
+struct I2cRequest
+{
+    uint8_t writeData[2];
+    uint8_t writeLength;
+    uint8_t *readData;
+    uint8_t readLength;
+    I2cCallback done;
+};
+
+// Bus provides:
+//   start(addressByte) - send a (repeated) start and the address with R/W bit
+//   write(data)        - send a byte
+//   read()             - the byte just received
+//   ack()              - acknowledge it and receive another
+//   stop()             - not acknowledge a received byte, then stop
+//   failed()           - the last address or byte was not acknowledged,
+//                        arbitration was lost or the bus errored
+//   abort()            - stop after a failure and leave the bus idle
+//   lock(), unlock(saved) - mask the bus interrupt and restore it
+// Callbacks run from the bus interrupt once their request finishes.
+template <class Bus, int SIZE>
+struct I2cQueue
+{
+    Bus bus;
+    uint8_t address;
+    // Ored into the register address of multi-byte reads.
+    uint8_t autoIncrement;
+
+    I2cRequest requests[SIZE];
+    volatile uint8_t head;
+    volatile uint8_t tail;
+    // Bytes of the running request written or read so far.
+    uint8_t index;
+
+    void begin(uint8_t deviceAddress, uint8_t autoIncrementBit)
+    {
+        address = deviceAddress;
+        autoIncrement = autoIncrementBit;
+        head = 0;
+        tail = 0;
+    }
+
+    void startNext(void)
+    {
+        if (tail == head)
+            return;
+        index = 0;
+        bus.start(address << 1 | (requests[tail].writeLength ? 0 : 1));
+    }
+
+    void finish(bool ok)
+    {
+        // Start the next request before the callback, which may queue another one.
+        I2cCallback done = requests[tail].done;
+        tail = (tail + 1) % SIZE;
+        startNext();
+        if (done)
+            done(ok);
+    }
+
+    // The bus interrupt, with the causes that are pending.
+    void service(uint8_t flags)
+    {
+        // A stray interrupt with nothing queued: stop, which also clears
+        // the bus flags, and leave the queue as it is.
+        if (tail == head)
+        {
+            bus.abort();
+            return;
+        }
+        I2cRequest &request = requests[tail];
+        if (flags & I2C_FLAG_ERROR)
+        {
+            bus.abort();
+            finish(false);
+            return;
+        }
+
+        // Master on bus: address or data byte sent.
+        if (flags & I2C_FLAG_MB)
+        {
+            if (bus.failed())
+            {
+                bus.abort();
+                finish(false);
+            }
+            else if (index < request.writeLength)
+                bus.write(request.writeData[index++]);
+            else if (request.readLength)
+            {
+                // Repeated start to read the register back.
+                index = 0;
+                bus.start(address << 1 | 1);
+            }
+            else
+            {
+                bus.stop();
+                finish(true);
+            }
+            return;
+        }
+
+        // Slave on bus: a byte was received. Acknowledge all but the last one.
+        if (flags & I2C_FLAG_SB)
+        {
+            request.readData[index++] = bus.read();
+            if (index < request.readLength)
+                bus.ack();
+            else
+            {
+                bus.stop();
+                finish(true);
+            }
+        }
+    }
+
+    // Queue a request, from the main program or any interrupt. Returns false
+    // when the queue is full.
+    bool submit(const I2cRequest &request)
+    {
+        uint32_t saved = bus.lock();
+        uint8_t next = (head + 1) % SIZE;
+        bool queued = next != tail;
+        if (queued)
+        {
+            bool idle = head == tail;
+            requests[head] = request;
+            head = next;
+            if (idle)
+                startNext();
+        }
+        bus.unlock(saved);
+        return queued;
+    }
+
+    // Drop everything queued and leave the bus idle, for a request that never
+    // finished. The dropped requests' callbacks do not run.
+    void flush(void)
+    {
+        uint32_t saved = bus.lock();
+        bus.abort();
+        tail = head;
+        bus.unlock(saved);
+    }
+
+    bool write(uint8_t reg, uint8_t value, I2cCallback done)
+    {
+        I2cRequest request = {{reg, value}, 2, 0, 0, done};
+        return submit(request);
+    }
+
+    bool read(uint8_t reg, uint8_t *data, uint8_t length, I2cCallback done)
+    {
+        I2cRequest request = {{(uint8_t)(length > 1 ? reg | autoIncrement : reg)}, 1, data, length, done};
+        return submit(request);
+    }
+};
+
+#endif
@@ -6,35 +6,83 @@
 * */
 
 #include <Adafruit_CircuitPlayground.h>
+#include <Adafruit_NeoPixel.h>
+#include <FlashStorage.h>
 
-// Frequencies and sound durations for end-of-cycle tones.
-#define PITCH_C3 130
-#define PITCH_E3 164
-#define PITCH_G3 196
-#define SOUND_DURATION_MS 50
+#include "activity.h"
+#include "chimes.h"
+#include "i2c_queue.h"
+#include "pomodoro_timer.h"
+#include "quantile_sketch.h"
+#include "synth.h"
+
+#define SYNTH_DMA_CHANNEL 0
 
 // How hard to tap for detection. Lower number = less force.
 #define TAP_THRESHOLD_FORCE 15
 
-// Number of lights available to illuminate on the board.
-// Circuit Playground Express has 10.
-#define CT_NEOPIXELS 10
+// The LIS3DH sits alone on Wire1, the internal I2C bus on SERCOM1.
+#define LIS3DH_ADDRESS 0x19
+#define LIS3DH_SERCOM SERCOM1
+#define LIS3DH_SERCOM_IRQn SERCOM1_IRQn
+#define I2C_QUEUE_SIZE 8
 
-// 25 minutes work, 5 minutes short break, 15 minutes long break = 1500, 300, 900
-#define WORK_SECONDS 1500 // 25 minutes work = 1500 seconds
-#define WORK_US 1000000 * WORK_SECONDS
-#define WORK_COLOR 0xff0b0b
+// LIS3DH registers. Setting the top bit of the address auto-increments it.
+#define LIS3DH_REG_WHOAMI 0x0f
+#define LIS3DH_REG_CTRL1 0x20
+#define LIS3DH_REG_CTRL3 0x22
+#define LIS3DH_REG_CTRL4 0x23
+#define LIS3DH_REG_CTRL5 0x24
+#define LIS3DH_REG_OUT_X_L 0x28
+#define LIS3DH_REG_FIFO_CTRL 0x2e
+#define LIS3DH_REG_FIFO_SRC 0x2f
+#define LIS3DH_REG_CLICKCFG 0x38
+#define LIS3DH_REG_CLICKTHS 0x3a
+#define LIS3DH_REG_TIMELIMIT 0x3b
+#define LIS3DH_REG_TIMELATENCY 0x3c
+#define LIS3DH_REG_TIMEWINDOW 0x3d
+#define LIS3DH_AUTO_INCREMENT 0x80
 
-#define SBRK_SECONDS 300 // 5 minutes break = 300 seconds
-#define SBRK_US 1000000 * SBRK_SECONDS
-#define SBRK_COLOR 0xff0aff
+// CTRL1 for ACCEL_ODR_HZ (activity.h), and tap timings in ms. At 400 Hz
+// they come to the counts CircuitPlayground.begin() sets (10, 20 and 255).
+#define ACCEL_CTRL1_400HZ_XYZ 0x77
+#define TAP_TIME_LIMIT_MS 25
+#define TAP_LATENCY_MS 50
+#define TAP_WINDOW_MS 637
+
+// Activity during work intervals: the FIFO is drained 16 times a second
+// (32 samples hold 80 ms at 400 Hz).
+#define ACTIVITY_POLL_HZ 16
 
-#define LBRK_SECONDS 900 // 15 minutes long break = 900 seconds
-#define LBRK_US 1000000 * LBRK_SECONDS
+// Colors of the work, short break and long break states. Their lengths
+// live in pomodoro_timer.h.
+#define WORK_COLOR 0xff0b0b
+#define SBRK_COLOR 0xff0aff
 #define LBRK_COLOR 0x0affff
 
-// number of work sessions before long break (usually 4)
-#define NUM_WORK_BEFORE_LONG_BREAK 4
+// Projects a work interval can be attributed to, cycled with the left button while paused.
+#define CT_TAGS 6
+
+// External NeoPixel matrix on pad A1 showing the minutes left, wired in
+// rows from the top left, optionally zig-zagging.
+#define MATRIX_PIN A1
+#define MATRIX_WIDTH 8
+#define MATRIX_HEIGHT 8
+#define MATRIX_SERPENTINE 1
+// Digits are 3x5 font cells scaled up on larger matrices.
+#define MATRIX_SCALE (MATRIX_WIDTH >= 16 && MATRIX_HEIGHT >= 10 ? 2 : 1)
+
+// Loop watchdog: TC3 checks the running loop() iteration against its stage
+// budget WATCHDOG_CHECK_HZ times a second, and kicks the hardware watchdog
+// while loop() makes progress. The hardware watchdog resets the board after
+// about 4 s without progress, warning 2 s before so the stall is recorded.
+#define WATCHDOG_CHECK_HZ 100
+
+// Serial port speed for the statistics readout.
+#define SERIAL_BAUD 115200
+
+// Length of a day for rolling per-day statistics (no RTC, so days are uptime days).
+#define DAY_MS 86400000UL
 
 // Illuminate numPixels NeoPixels in base-2 using color (works for [0, 2^10 - 1])
 void drawNLightsBinaryWithColor(int numPixels, int color)
@@ -62,146 +110,1648 @@ void drawNLightsWithColor(int numPixels, int color)
         CircuitPlayground.setPixelColor(i, color);
 }
 
+// Event tracing for tools/replay_trace.cpp. While tracing, the interrupt
+// handlers queue timestamped user events and loop() prints them together
+// with the state transitions and pixel bar changes they led to.
+#define TRACE_TAP 0
+#define TRACE_LEFT 1
+#define TRACE_RIGHT 2
+#define TRACE_OFF 3
+#define TRACE_ON 4
+#define TRACE_QUEUE_SIZE 16
+
+const char *traceEventNames[] = {"tap", "left", "right", "off", "on"};
+
+struct TraceEvent
+{
+    unsigned long ms;
+    uint8_t type;
+};
+
+volatile bool tracing = false;
+volatile TraceEvent traceQueue[TRACE_QUEUE_SIZE];
+volatile uint8_t traceHead = 0;
+volatile uint8_t traceTail = 0;
+volatile unsigned long traceDroppedCt = 0;
+// Drops already reported in the trace.
+unsigned long traceDroppedReported = 0;
+
+void traceEvent(uint8_t type)
+{
+    if (!tracing)
+        return;
+    uint8_t next = (traceHead + 1) % TRACE_QUEUE_SIZE;
+    if (next == traceTail)
+    {
+        traceDroppedCt++;
+        return;
+    }
+    traceQueue[traceHead].ms = millis();
+    traceQueue[traceHead].type = type;
+    traceHead = next;
+}
+
 // Interrupt service routines to react to user HW interactions
-volatile bool isPaused = false;
-volatile bool didTogglePause = false;
+TimerControls controls;
 void togglePaused(void)
 {
-    isPaused = !isPaused;
-    didTogglePause = true;
+    // Timestamp the tap itself, loop() only notices it after an animation frame.
+    controls.tap(millis());
+    traceEvent(TRACE_TAP);
 }
 
 volatile bool playTones = true;
 void togglePlayTones(void)
 {
     playTones = !playTones;
+    traceEvent(TRACE_RIGHT);
 }
 
-volatile bool isOn = true;
 void toggleIsOn(void)
 {
-    isOn = !isOn;
+    controls.isOn = !controls.isOn;
+    traceEvent(controls.isOn ? TRACE_ON : TRACE_OFF);
+}
+
+// Left button pressed while paused, picks the next project tag.
+// Tags only change while paused so a stray press cannot retag a running interval.
+volatile int currentTag = 0;
+void cycleTag(void)
+{
+    if (controls.isPaused)
+        currentTag = (currentTag + 1) % CT_TAGS;
+    traceEvent(TRACE_LEFT);
 }
 
 // 3 states: work, short break, long break.
+// Their chimes live in chimes.h.
 const int colors[3] = {WORK_COLOR, SBRK_COLOR, LBRK_COLOR};
-const int sounds[3] = {PITCH_C3, PITCH_E3, PITCH_G3};
 const long durations[3] = {WORK_US, SBRK_US, LBRK_US};
 
-// Hold counter state: one of work, short break, long break
-short state = 0;
-int color = colors[state];
-int sound = sounds[state];
-long duration = durations[state];
+// One color per project tag, the first one is the work color.
+const int tagColors[CT_TAGS] = {WORK_COLOR, 0xffa00b, 0x0bff0b, 0x0b0bff, 0xffff0b, 0xffffff};
+
+// Interval state machine, see pomodoro_timer.h.
+PomodoroTimer timer;
+int color = colors[0];
 
-// Light up fraction of lights based on time passed
-int numPixels = 10;
-int lastNumPixels = 10;
+// Number of pomodoros per project tag, restored from flash at boot.
+uint16_t tagPomoCt[CT_TAGS];
 
-// Pomodoros in cycle before long break
-int thisCyclePomoCt = 0;
+// End-of-cycle chimes are rendered by a wavetable synthesiser into two
+// buffers that DMA plays out to the DAC, paced by TC5 at the sample rate.
+// Each finished buffer is refilled from the lowest priority interrupt.
+Synth synth;
+uint16_t synthBuffers[2][SYNTH_BUFFER_SAMPLES];
+__attribute__((__aligned__(16))) DmacDescriptor dmaDescriptors[SYNTH_DMA_CHANNEL + 1];
+__attribute__((__aligned__(16))) DmacDescriptor dmaWriteback[SYNTH_DMA_CHANNEL + 1];
+__attribute__((__aligned__(16))) DmacDescriptor synthPongDescriptor;
+volatile int synthRefillBuffer = 0;
 
-// Total number of pomodoros
-int totalPomoCt = 0;
+// Refill time in microseconds, by the number of voices sounding.
+volatile unsigned long synthRefillCt[SYNTH_VOICES + 1];
+volatile unsigned long synthRefillUs[SYNTH_VOICES + 1];
 
-// Time is tracked in ticks of microsecond precision.
-unsigned long lastMicros = micros();
+void DMAC_Handler(void)
+{
+    DMAC->CHID.reg = DMAC_CHID_ID(SYNTH_DMA_CHANNEL);
+    DMAC->CHINTFLAG.reg = DMAC_CHINTFLAG_TCMPL;
+
+    unsigned long start = micros();
+    int sounding = synth.render(synthBuffers[synthRefillBuffer], SYNTH_BUFFER_SAMPLES);
+    synthRefillBuffer ^= 1;
+    synthRefillCt[sounding]++;
+    synthRefillUs[sounding] += micros() - start;
+
+    // Keep the speaker amplifier off between chimes to avoid hiss.
+    if (sounding == 0)
+        digitalWrite(CPLAY_SPEAKER_SHUTDOWN, LOW);
+}
+
+void setDmaDescriptor(DmacDescriptor &descriptor, uint16_t *buffer, DmacDescriptor &next)
+{
+    descriptor.BTCTRL.reg = DMAC_BTCTRL_VALID | DMAC_BTCTRL_BEATSIZE_HWORD | DMAC_BTCTRL_SRCINC | DMAC_BTCTRL_BLOCKACT_INT;
+    descriptor.BTCNT.reg = SYNTH_BUFFER_SAMPLES;
+    // With address increment the source is the address past the last beat.
+    descriptor.SRCADDR.reg = (uint32_t)(buffer + SYNTH_BUFFER_SAMPLES);
+    descriptor.DSTADDR.reg = (uint32_t)&DAC->DATA.reg;
+    descriptor.DESCADDR.reg = (uint32_t)&next;
+}
+
+void beginSynth(void)
+{
+    // DAC on A0 at 10 bits, idling at mid scale.
+    analogWriteResolution(10);
+    analogWrite(A0, SYNTH_DAC_MID);
+    pinMode(CPLAY_SPEAKER_SHUTDOWN, OUTPUT);
+    digitalWrite(CPLAY_SPEAKER_SHUTDOWN, LOW);
+
+    synth.init();
+    synth.render(synthBuffers[0], SYNTH_BUFFER_SAMPLES);
+    synth.render(synthBuffers[1], SYNTH_BUFFER_SAMPLES);
+
+    // TC5 overflows at the sample rate, each overflow moves one sample.
+    PM->APBCMASK.reg |= PM_APBCMASK_TC5;
+    GCLK->CLKCTRL.reg = GCLK_CLKCTRL_CLKEN | GCLK_CLKCTRL_GEN_GCLK0 | GCLK_CLKCTRL_ID(GCM_TC4_TC5);
+    while (GCLK->STATUS.bit.SYNCBUSY)
+        ;
+    TC5->COUNT16.CTRLA.reg = TC_CTRLA_SWRST;
+    while (TC5->COUNT16.CTRLA.bit.SWRST)
+        ;
+    TC5->COUNT16.CTRLA.reg = TC_CTRLA_MODE_COUNT16 | TC_CTRLA_WAVEGEN_MFRQ | TC_CTRLA_PRESCALER_DIV1;
+    TC5->COUNT16.CC[0].reg = F_CPU / SYNTH_SAMPLE_RATE - 1;
+    while (TC5->COUNT16.STATUS.bit.SYNCBUSY)
+        ;
+
+    // Ping and pong descriptors link to each other, interrupting after each block.
+    PM->AHBMASK.reg |= PM_AHBMASK_DMAC;
+    PM->APBBMASK.reg |= PM_APBBMASK_DMAC;
+    DMAC->BASEADDR.reg = (uint32_t)dmaDescriptors;
+    DMAC->WRBADDR.reg = (uint32_t)dmaWriteback;
+    DMAC->CTRL.reg = DMAC_CTRL_DMAENABLE | DMAC_CTRL_LVLEN(0xf);
+    DMAC->CHID.reg = DMAC_CHID_ID(SYNTH_DMA_CHANNEL);
+    DMAC->CHCTRLA.reg &= ~DMAC_CHCTRLA_ENABLE;
+    DMAC->CHCTRLA.reg = DMAC_CHCTRLA_SWRST;
+    DMAC->CHCTRLB.reg = DMAC_CHCTRLB_LVL(0) | DMAC_CHCTRLB_TRIGSRC(TC5_DMAC_ID_OVF) | DMAC_CHCTRLB_TRIGACT_BEAT;
+    DMAC->CHINTENSET.reg = DMAC_CHINTENSET_TCMPL;
+    setDmaDescriptor(dmaDescriptors[SYNTH_DMA_CHANNEL], synthBuffers[0], synthPongDescriptor);
+    setDmaDescriptor(synthPongDescriptor, synthBuffers[1], dmaDescriptors[SYNTH_DMA_CHANNEL]);
+
+    // Refills are the least urgent work on the board, so loop() and the
+    // user interrupts always win.
+    NVIC_SetPriority(DMAC_IRQn, (1 << __NVIC_PRIO_BITS) - 1);
+    NVIC_EnableIRQ(DMAC_IRQn);
+    DMAC->CHCTRLA.reg |= DMAC_CHCTRLA_ENABLE;
+
+    TC5->COUNT16.CTRLA.reg |= TC_CTRLA_ENABLE;
+    while (TC5->COUNT16.STATUS.bit.SYNCBUSY)
+        ;
+}
+
+// Start a two-voice chime. Returns at once, the refill interrupt plays it out.
+void playChime(int forState)
+{
+    // The amplifier goes on with the refill interrupt masked, else a refill
+    // that still finds the voices silent switches it straight off again.
+    NVIC_DisableIRQ(DMAC_IRQn);
+    synth.noteOn(0, sounds[forState], SOUND_DURATION_MS, chimeEnvelope);
+    synth.noteOn(1, harmonies[forState], SOUND_DURATION_MS, chimeEnvelope);
+    digitalWrite(CPLAY_SPEAKER_SHUTDOWN, HIGH);
+    NVIC_EnableIRQ(DMAC_IRQn);
+}
+
+// Non-blocking LIS3DH access through the request queue in i2c_queue.h,
+// run back to back by the SERCOM interrupt, which calls each request's
+// callback from interrupt context once it finishes. Wire1 installs its own
+// SERCOM1 handler for slave mode, so ours is patched into a copy of the
+// vector table in RAM.
+struct SercomI2cBus
+{
+    static void sync(void)
+    {
+        while (LIS3DH_SERCOM->I2CM.SYNCBUSY.bit.SYSOP)
+            ;
+    }
+
+    void start(uint8_t addressByte)
+    {
+        LIS3DH_SERCOM->I2CM.ADDR.reg = addressByte;
+        sync();
+    }
+
+    void write(uint8_t data)
+    {
+        LIS3DH_SERCOM->I2CM.DATA.reg = data;
+    }
+
+    uint8_t read(void)
+    {
+        return LIS3DH_SERCOM->I2CM.DATA.reg;
+    }
+
+    void ack(void)
+    {
+        LIS3DH_SERCOM->I2CM.CTRLB.bit.ACKACT = 0;
+        LIS3DH_SERCOM->I2CM.CTRLB.bit.CMD = 2;
+        sync();
+    }
+
+    void stop(void)
+    {
+        LIS3DH_SERCOM->I2CM.CTRLB.bit.ACKACT = 1;
+        LIS3DH_SERCOM->I2CM.CTRLB.bit.CMD = 3;
+        sync();
+    }
+
+    bool failed(void)
+    {
+        SercomI2cm &i2c = LIS3DH_SERCOM->I2CM;
+        return i2c.STATUS.bit.RXNACK || i2c.STATUS.bit.ARBLOST || i2c.STATUS.bit.BUSERR;
+    }
+
+    // Clear the error flags and force the bus state back to idle, else the
+    // next request would start on a bus the SERCOM still thinks is broken.
+    void abort(void)
+    {
+        stop();
+        LIS3DH_SERCOM->I2CM.STATUS.reg = SERCOM_I2CM_STATUS_BUSERR | SERCOM_I2CM_STATUS_ARBLOST | SERCOM_I2CM_STATUS_BUSSTATE(1);
+        sync();
+    }
+
+    uint32_t lock(void)
+    {
+        uint32_t primask = __get_PRIMASK();
+        __disable_irq();
+        return primask;
+    }
+
+    void unlock(uint32_t primask)
+    {
+        __set_PRIMASK(primask);
+    }
+};
+
+I2cQueue<SercomI2cBus, I2C_QUEUE_SIZE> lis3dhQueue;
+
+__attribute__((__aligned__(256))) DeviceVectors ramVectors;
+
+void lis3dhI2cHandler(void)
+{
+    uint8_t flags = LIS3DH_SERCOM->I2CM.INTFLAG.reg;
+    if (flags & SERCOM_I2CM_INTFLAG_ERROR)
+        LIS3DH_SERCOM->I2CM.INTFLAG.reg = SERCOM_I2CM_INTFLAG_ERROR;
+    lis3dhQueue.service(flags);
+}
+
+bool lis3dhWriteAsync(uint8_t reg, uint8_t value, I2cCallback done)
+{
+    return lis3dhQueue.write(reg, value, done);
+}
+
+bool lis3dhReadAsync(uint8_t reg, uint8_t *data, uint8_t length, I2cCallback done)
+{
+    return lis3dhQueue.read(reg, data, length, done);
+}
+
+// Blocking shim over the queue for setup() and other one-off accesses. It
+// gives up after I2C_BLOCKING_TIMEOUT_US, long enough for a full FIFO read
+// queued ahead of it, so a device holding the bus cannot hang setup(),
+// which runs before the watchdog is armed.
+#define I2C_BLOCKING_TIMEOUT_US 50000
+
+volatile bool i2cBlockingDone;
+volatile bool i2cBlockingOk;
+unsigned long i2cTimeoutCt = 0;
+
+void i2cBlockingCallback(bool ok)
+{
+    i2cBlockingOk = ok;
+    i2cBlockingDone = true;
+}
+
+bool i2cWait(bool queued)
+{
+    if (!queued)
+        return false;
+    unsigned long start = micros();
+    while (!i2cBlockingDone)
+    {
+        if (micros() - start > I2C_BLOCKING_TIMEOUT_US)
+        {
+            // The caller's buffer may not outlive this call, so the request
+            // cannot be left to finish later.
+            lis3dhQueue.flush();
+            i2cTimeoutCt++;
+            return false;
+        }
+    }
+    return i2cBlockingOk;
+}
+
+bool lis3dhWrite(uint8_t reg, uint8_t value)
+{
+    i2cBlockingDone = false;
+    return i2cWait(lis3dhWriteAsync(reg, value, i2cBlockingCallback));
+}
+
+bool lis3dhRead(uint8_t reg, uint8_t *data, uint8_t length)
+{
+    i2cBlockingDone = false;
+    return i2cWait(lis3dhReadAsync(reg, data, length, i2cBlockingCallback));
+}
+
+// Take over Wire1's interrupt once CircuitPlayground.begin() is done with it.
+void beginLis3dhAsync(void)
+{
+    lis3dhQueue.begin(LIS3DH_ADDRESS, LIS3DH_AUTO_INCREMENT);
+    memcpy(&ramVectors, (const void *)SCB->VTOR, sizeof(ramVectors));
+    ramVectors.pfnSERCOM1_Handler = (void *)lis3dhI2cHandler;
+    __DSB();
+    SCB->VTOR = (uint32_t)&ramVectors;
+    __DSB();
+
+    LIS3DH_SERCOM->I2CM.INTENSET.reg = SERCOM_I2CM_INTENSET_MB | SERCOM_I2CM_INTENSET_SB | SERCOM_I2CM_INTENSET_ERROR;
+    NVIC_SetPriority(LIS3DH_SERCOM_IRQn, 2);
+    NVIC_EnableIRQ(LIS3DH_SERCOM_IRQn);
+}
+
+// Same register writes as CircuitPlayground.setAccelRange and setAccelTap.
+void setAccelRange(uint8_t range)
+{
+    uint8_t ctrl4;
+    if (lis3dhRead(LIS3DH_REG_CTRL4, &ctrl4, 1))
+        lis3dhWrite(LIS3DH_REG_CTRL4, (ctrl4 & ~0x30) | range << 4);
+}
+
+uint8_t odrTicks(int ms)
+{
+    return (ms * ACCEL_ODR_HZ + 999) / 1000;
+}
+
+void setAccelTap(uint8_t threshold)
+{
+    // Click on INT1, single taps on all axes.
+    lis3dhWrite(LIS3DH_REG_CTRL3, 0x80);
+    lis3dhWrite(LIS3DH_REG_CTRL5, 0x08);
+    lis3dhWrite(LIS3DH_REG_CLICKCFG, 0x15);
+    lis3dhWrite(LIS3DH_REG_CLICKTHS, threshold);
+    lis3dhWrite(LIS3DH_REG_TIMELIMIT, odrTicks(TAP_TIME_LIMIT_MS));
+    lis3dhWrite(LIS3DH_REG_TIMELATENCY, odrTicks(TAP_LATENCY_MS));
+    lis3dhWrite(LIS3DH_REG_TIMEWINDOW, odrTicks(TAP_WINDOW_MS));
+}
+
+// Activity index: TC4 wakes ACTIVITY_POLL_HZ times a second and, during a
+// running work interval, queues a read of the FIFO fill level and then of
+// the samples themselves. The samples are reduced in the I2C completion
+// callback into the sum of sample-to-sample changes (mg, summed over axes)
+// and a count of peaks (activity.h), so loop() never sees them.
+uint8_t fifoSource;
+uint8_t fifoSamples[LIS3DH_FIFO_SAMPLES * LIS3DH_SAMPLE_BYTES];
+// Set while not sampling, so the next batch, which may hold samples from
+// before the interval resumed, only primes the meter.
+volatile bool activityStale = true;
+// Interval totals are read and cleared by loop() with interrupts masked.
+ActivityMeter activity;
+
+// Sampling cost, for the statistics report.
+volatile unsigned long activityBatchCt = 0;
+volatile unsigned long activitySampleCt = 0;
+volatile unsigned long activityReduceUs = 0;
+
+// FIFO dump for tools/activity_replay.cpp, toggled with the 'f' command.
+// A batch is copied while the previous one has been printed; gaps in the
+// batch numbers show the ones skipped.
+struct FifoDump
+{
+    unsigned long ms;
+    unsigned long batch;
+    bool priming;
+    uint8_t count;
+    unsigned long sum;
+    unsigned long peakCt;
+    uint8_t samples[LIS3DH_FIFO_SAMPLES * LIS3DH_SAMPLE_BYTES];
+};
+
+bool fifoDumping = false;
+FifoDump fifoDump;
+volatile bool fifoDumpFull = false;
+
+void onFifoSamples(bool ok)
+{
+    if (!ok)
+        return;
+    unsigned long start = micros();
+    bool priming = activityStale;
+    activityStale = false;
+    int count = ActivityMeter::fifoCount(fifoSource);
+    unsigned long sumBefore = activity.sum;
+    unsigned long peakCtBefore = activity.peakCt;
+    activity.reduce(fifoSamples, count, priming);
+    activityBatchCt++;
+    activitySampleCt += count;
+    activityReduceUs += micros() - start;
+
+    if (fifoDumping && !fifoDumpFull)
+    {
+        fifoDump.ms = millis();
+        fifoDump.batch = activityBatchCt;
+        fifoDump.priming = priming;
+        fifoDump.count = count;
+        fifoDump.sum = activity.sum - sumBefore;
+        fifoDump.peakCt = activity.peakCt - peakCtBefore;
+        memcpy(fifoDump.samples, fifoSamples, count * LIS3DH_SAMPLE_BYTES);
+        fifoDumpFull = true;
+    }
+}
+
+void onFifoSource(bool ok)
+{
+    int count = ActivityMeter::fifoCount(fifoSource);
+    if (ok && count > 0)
+        lis3dhReadAsync(LIS3DH_REG_OUT_X_L, fifoSamples, count * LIS3DH_SAMPLE_BYTES, onFifoSamples);
+}
+
+// One line per dumped batch:
+//   fifo <ms> <batch> <priming> <count> <sum mg> <peaks> <samples as hex>
+void printFifoDump(void)
+{
+    if (!fifoDumpFull)
+        return;
+    Serial.print("fifo ");
+    Serial.print(fifoDump.ms);
+    Serial.print(' ');
+    Serial.print(fifoDump.batch);
+    Serial.print(' ');
+    Serial.print(fifoDump.priming ? 1 : 0);
+    Serial.print(' ');
+    Serial.print(fifoDump.count);
+    Serial.print(' ');
+    Serial.print(fifoDump.sum);
+    Serial.print(' ');
+    Serial.print(fifoDump.peakCt);
+    Serial.print(' ');
+    for (int i = 0; i < fifoDump.count * LIS3DH_SAMPLE_BYTES; i++)
+    {
+        if (fifoDump.samples[i] < 0x10)
+            Serial.print('0');
+        Serial.print(fifoDump.samples[i], HEX);
+    }
+    Serial.println();
+    fifoDumpFull = false;
+}
+
+void TC4_Handler(void)
+{
+    TC4->COUNT16.INTFLAG.reg = TC_INTFLAG_OVF;
+    if (timer.state != 0 || controls.mode() != LOOP_RUNNING)
+    {
+        activityStale = true;
+        return;
+    }
+    lis3dhReadAsync(LIS3DH_REG_FIFO_SRC, &fifoSource, 1, onFifoSource);
+}
+
+void beginActivitySampling(void)
+{
+    activity.begin(ACTIVITY_PEAK_THRESHOLD_MG);
+
+    // 400 Hz, high resolution, samples kept in the FIFO in stream mode.
+    lis3dhWrite(LIS3DH_REG_CTRL1, ACCEL_CTRL1_400HZ_XYZ);
+    lis3dhWrite(LIS3DH_REG_CTRL5, 0x48);
+    lis3dhWrite(LIS3DH_REG_FIFO_CTRL, 0x80);
+
+    // TC4 shares its clock with TC5, 48 MHz / 1024.
+    PM->APBCMASK.reg |= PM_APBCMASK_TC4;
+    GCLK->CLKCTRL.reg = GCLK_CLKCTRL_CLKEN | GCLK_CLKCTRL_GEN_GCLK0 | GCLK_CLKCTRL_ID(GCM_TC4_TC5);
+    while (GCLK->STATUS.bit.SYNCBUSY)
+        ;
+    TC4->COUNT16.CTRLA.reg = TC_CTRLA_SWRST;
+    while (TC4->COUNT16.CTRLA.bit.SWRST)
+        ;
+    TC4->COUNT16.CTRLA.reg = TC_CTRLA_MODE_COUNT16 | TC_CTRLA_WAVEGEN_MFRQ | TC_CTRLA_PRESCALER_DIV1024;
+    TC4->COUNT16.CC[0].reg = F_CPU / 1024 / ACTIVITY_POLL_HZ - 1;
+    while (TC4->COUNT16.STATUS.bit.SYNCBUSY)
+        ;
+    TC4->COUNT16.INTENSET.reg = TC_INTENSET_OVF;
+    NVIC_SetPriority(TC4_IRQn, (1 << __NVIC_PRIO_BITS) - 1);
+    NVIC_EnableIRQ(TC4_IRQn);
+    TC4->COUNT16.CTRLA.reg |= TC_CTRLA_ENABLE;
+    while (TC4->COUNT16.STATUS.bit.SYNCBUSY)
+        ;
+}
+
+void printActivitySampling(void)
+{
+    Serial.print("activity batches=");
+    Serial.print(activityBatchCt);
+    Serial.print(" samples=");
+    Serial.print(activitySampleCt);
+    Serial.print(" reduce_us_per_batch=");
+    Serial.println(activityBatchCt ? activityReduceUs / activityBatchCt : 0);
+}
+
+// Time how long the caller is held up by one register read, through the
+// blocking shim and when only queueing it.
+uint8_t accelProbe;
+
+void printAccelAccessTimes(void)
+{
+    unsigned long start = micros();
+    lis3dhRead(LIS3DH_REG_WHOAMI, &accelProbe, 1);
+    unsigned long blockingUs = micros() - start;
+
+    start = micros();
+    lis3dhReadAsync(LIS3DH_REG_WHOAMI, &accelProbe, 1, NULL);
+    unsigned long queueUs = micros() - start;
+
+    Serial.print("accel blocking_us=");
+    Serial.print(blockingUs);
+    Serial.print(" async_us=");
+    Serial.print(queueUs);
+    Serial.print(" timeouts=");
+    Serial.println(i2cTimeoutCt);
+}
+
+// NeoPixel strip that can send only the first pixels of its chain. Pixels
+// past the end of a transmission keep what they last latched, so a change
+// costs the pixels up to the last changed one rather than the whole chain.
+class PrefixNeoPixel : public Adafruit_NeoPixel
+{
+public:
+    PrefixNeoPixel(uint16_t count, int16_t pin) : Adafruit_NeoPixel(count, pin, NEO_GRB + NEO_KHZ800) {}
+
+    void showPrefix(uint16_t count)
+    {
+        uint16_t allBytes = numBytes;
+        numBytes = count * 3;
+        show();
+        numBytes = allBytes;
+    }
+};
+
+// 3x5 digits, one row per byte with the leftmost column in bit 2.
+const uint8_t digitFont[10][5] = {
+    {7, 5, 5, 5, 7}, {2, 6, 2, 2, 7}, {7, 1, 7, 4, 7}, {7, 1, 7, 1, 7}, {5, 5, 7, 1, 1},
+    {7, 4, 7, 1, 7}, {7, 4, 7, 5, 7}, {7, 1, 1, 1, 1}, {7, 5, 7, 5, 7}, {7, 5, 7, 1, 7},
+};
+
+PrefixNeoPixel matrix(MATRIX_WIDTH * MATRIX_HEIGHT, MATRIX_PIN);
+uint32_t matrixFrame[MATRIX_HEIGHT][MATRIX_WIDTH];
+
+// Rectangle changed since the last transmission, empty when minX > maxX.
+int matrixDirtyMinX = MATRIX_WIDTH;
+int matrixDirtyMaxX = -1;
+int matrixDirtyMinY = MATRIX_HEIGHT;
+int matrixDirtyMaxY = -1;
+
+// Redraw once the time left drops below this; LONG_MAX forces a redraw.
+long matrixRedrawBelowUs = LONG_MAX;
+int intervalMatrixRedrawCt = 0;
+
+// Transmissions, pixels sent and time spent sending, for the statistics report.
+unsigned long matrixTransmitCt = 0;
+unsigned long matrixPixelsSent = 0;
+unsigned long matrixTransmitUs = 0;
+
+void setMatrixPixel(int x, int y, uint32_t pixelColor)
+{
+    if (matrixFrame[y][x] == pixelColor)
+        return;
+    matrixFrame[y][x] = pixelColor;
+    int column = MATRIX_SERPENTINE && (y & 1) ? MATRIX_WIDTH - 1 - x : x;
+    matrix.setPixelColor(y * MATRIX_WIDTH + column, pixelColor);
+    matrixDirtyMinX = min(matrixDirtyMinX, x);
+    matrixDirtyMaxX = max(matrixDirtyMaxX, x);
+    matrixDirtyMinY = min(matrixDirtyMinY, y);
+    matrixDirtyMaxY = max(matrixDirtyMaxY, y);
+}
+
+// Send the rows down to the last dirty one. Rows above the dirty rectangle
+// go out again too, as the chain cannot skip pixels.
+void transmitMatrix(void)
+{
+    if (matrixDirtyMinX > matrixDirtyMaxX)
+        return;
+    uint16_t count = (matrixDirtyMaxY + 1) * MATRIX_WIDTH;
+    unsigned long start = micros();
+    matrix.showPrefix(count);
+    matrixTransmitUs += micros() - start;
+    matrixTransmitCt++;
+    matrixPixelsSent += count;
+    matrixDirtyMinX = MATRIX_WIDTH;
+    matrixDirtyMaxX = -1;
+    matrixDirtyMinY = MATRIX_HEIGHT;
+    matrixDirtyMaxY = -1;
+}
+
+void drawMatrixDigit(int digit, int left, uint32_t digitColor)
+{
+    for (int row = 0; row < 5 * MATRIX_SCALE; row++)
+        for (int column = 0; column < 3 * MATRIX_SCALE; column++)
+        {
+            bool lit = digit >= 0 && (digitFont[digit][row / MATRIX_SCALE] >> (2 - column / MATRIX_SCALE)) & 1;
+            setMatrixPixel(left + column, row, lit ? digitColor : 0);
+        }
+}
+
+// Draw the minutes left, rounded up, in the top rows so that redraws send
+// as short a prefix of the chain as possible.
+void drawMatrixMinutes(void)
+{
+    // Rounded up, without adding to the duration, which may be close to LONG_MAX.
+    long minutes = timer.duration > 0 ? (timer.duration - 1) / 60000000L + 1 : 0;
+    minutes = min(minutes, 99L);
+    int left = (MATRIX_WIDTH - 7 * MATRIX_SCALE) / 2;
+    drawMatrixDigit(minutes >= 10 ? minutes / 10 : -1, left, color);
+    drawMatrixDigit(minutes % 10, left + 4 * MATRIX_SCALE, color);
+    transmitMatrix();
+    matrixRedrawBelowUs = (minutes - 1) * 60000000L;
+    intervalMatrixRedrawCt++;
+}
+
+void clearMatrix(void)
+{
+    for (int y = 0; y < MATRIX_HEIGHT; y++)
+        for (int x = 0; x < MATRIX_WIDTH; x++)
+            setMatrixPixel(x, y, 0);
+    transmitMatrix();
+    matrixRedrawBelowUs = LONG_MAX;
+}
+
+void printMatrixTransmits(void)
+{
+    Serial.print("matrix transmits=");
+    Serial.print(matrixTransmitCt);
+    Serial.print(" pixels=");
+    Serial.print(matrixPixelsSent);
+    Serial.print(" us_per_transmit=");
+    Serial.println(matrixTransmitCt ? matrixTransmitUs / matrixTransmitCt : 0);
+}
+
+// Stages of a loop() iteration, each with its own time budget.
+#define STAGE_SERIAL 0
+#define STAGE_TELEMETRY 1
+#define STAGE_OFF 2
+#define STAGE_PAUSED 3
+#define STAGE_TIMER 4
+#define STAGE_MATRIX 5
+#define STAGE_TRANSITION 6
+#define CT_STAGES 7
+
+const char *stageNames[CT_STAGES] = {"serial", "telemetry", "off", "paused", "timer", "matrix", "transition"};
+// Reports can wait on the USB host, a pause animation frame takes up to
+// 1.1 s and a transition writes flash.
+const unsigned long stageBudgetsMs[CT_STAGES] = {250, 5, 5, 1500, 5, 15, 100};
+
+// Each stage's budget runs from when the stage was entered. The watchdog
+// is kicked once per iteration, whose start is kept for its warnings.
+volatile uint8_t loopStage = STAGE_SERIAL;
+volatile unsigned long stageStartMs = 0;
+volatile unsigned long iterationStartMs = 0;
+volatile unsigned long loopIterationCt = 0;
+unsigned long kickedIterationCt = 0;
+volatile bool overrunFlagged = false;
+
+// Overrun counts and the last overrun or watchdog warning, in RAM that the
+// startup code does not clear so that they survive a reset. Validated by
+// the magic number after a power cycle. The .noinit section comes from
+// noinit.ld; its bounds are referenced so that a build linked without it
+// fails instead of leaving forensics wherever the linker puts orphans.
+#define FORENSICS_MAGIC 0x0b5e55edUL
+
+struct OverrunForensics
+{
+    uint32_t magic;
+    uint32_t overrunCts[CT_STAGES];
+    uint32_t watchdogCt;
+    uint32_t lastStage;
+    uint32_t lastPc;
+    uint32_t lastElapsedMs;
+    uint32_t lastWasWatchdog;
+};
+
+extern "C" uint32_t __noinit_start__;
+extern "C" uint32_t __noinit_end__;
+
+__attribute__((section(".noinit"))) OverrunForensics forensics;
+uint8_t resetCause;
+bool forensicsKept;
+
+// The stage is switched last, so TC3 never checks the new stage against
+// the start time of the old one.
+void setLoopStage(uint8_t stage)
+{
+    stageStartMs = millis();
+    overrunFlagged = false;
+    loopStage = stage;
+}
+
+void beginLoopStage(uint8_t stage)
+{
+    iterationStartMs = millis();
+    loopIterationCt++;
+    setLoopStage(stage);
+}
+
+// The interrupted program counter is the seventh word of the exception frame.
+void recordOverrun(uint32_t *frame, unsigned long elapsedMs, bool watchdog)
+{
+    forensics.lastStage = loopStage;
+    forensics.lastPc = frame[6];
+    forensics.lastElapsedMs = elapsedMs;
+    forensics.lastWasWatchdog = watchdog;
+}
+
+extern "C" void watchdogTick(uint32_t *frame)
+{
+    TC3->COUNT16.INTFLAG.reg = TC_INTFLAG_OVF;
+    unsigned long elapsedMs = millis() - stageStartMs;
+    if (!overrunFlagged && elapsedMs > stageBudgetsMs[loopStage])
+    {
+        overrunFlagged = true;
+        forensics.overrunCts[loopStage]++;
+        recordOverrun(frame, elapsedMs, false);
+    }
+    if (loopIterationCt != kickedIterationCt && !WDT->STATUS.bit.SYNCBUSY)
+    {
+        WDT->CLEAR.reg = WDT_CLEAR_CLEAR_KEY;
+        kickedIterationCt = loopIterationCt;
+    }
+}
+
+extern "C" void watchdogEarlyWarning(uint32_t *frame)
+{
+    WDT->INTFLAG.reg = WDT_INTFLAG_EW;
+    forensics.watchdogCt++;
+    recordOverrun(frame, millis() - iterationStartMs, true);
+}
+
+// Both handlers pass the exception frame on the main stack to C.
+__attribute__((naked)) void TC3_Handler(void)
+{
+    __asm volatile("mrs r0, msp\n"
+                   "ldr r1, =watchdogTick\n"
+                   "bx r1\n"
+                   ".ltorg\n");
+}
+
+__attribute__((naked)) void WDT_Handler(void)
+{
+    __asm volatile("mrs r0, msp\n"
+                   "ldr r1, =watchdogEarlyWarning\n"
+                   "bx r1\n"
+                   ".ltorg\n");
+}
+
+void beginWatchdog(void)
+{
+    resetCause = PM->RCAUSE.reg;
+    forensicsKept = (uint32_t *)&forensics >= &__noinit_start__ && (uint32_t *)(&forensics + 1) <= &__noinit_end__;
+    if (!forensicsKept || forensics.magic != FORENSICS_MAGIC)
+    {
+        memset(&forensics, 0, sizeof(forensics));
+        forensics.magic = FORENSICS_MAGIC;
+    }
+    beginLoopStage(STAGE_SERIAL);
+
+    // TC3 from the 48 MHz clock / 64.
+    PM->APBCMASK.reg |= PM_APBCMASK_TC3;
+    GCLK->CLKCTRL.reg = GCLK_CLKCTRL_CLKEN | GCLK_CLKCTRL_GEN_GCLK0 | GCLK_CLKCTRL_ID(GCM_TCC2_TC3);
+    while (GCLK->STATUS.bit.SYNCBUSY)
+        ;
+    TC3->COUNT16.CTRLA.reg = TC_CTRLA_SWRST;
+    while (TC3->COUNT16.CTRLA.bit.SWRST)
+        ;
+    TC3->COUNT16.CTRLA.reg = TC_CTRLA_MODE_COUNT16 | TC_CTRLA_WAVEGEN_MFRQ | TC_CTRLA_PRESCALER_DIV64;
+    TC3->COUNT16.CC[0].reg = F_CPU / 64 / WATCHDOG_CHECK_HZ - 1;
+    while (TC3->COUNT16.STATUS.bit.SYNCBUSY)
+        ;
+    TC3->COUNT16.INTENSET.reg = TC_INTENSET_OVF;
+    // Above the synthesiser, sampling and I2C interrupts, so stalls in them show up too.
+    NVIC_SetPriority(TC3_IRQn, 1);
+    NVIC_EnableIRQ(TC3_IRQn);
+    TC3->COUNT16.CTRLA.reg |= TC_CTRLA_ENABLE;
+    while (TC3->COUNT16.STATUS.bit.SYNCBUSY)
+        ;
+
+    // Watchdog from the 32 kHz ultra low power oscillator / 32 on GCLK2:
+    // reset after 4096 ticks (4 s), early warning after 2048.
+    GCLK->GENDIV.reg = GCLK_GENDIV_ID(2) | GCLK_GENDIV_DIV(4);
+    GCLK->GENCTRL.reg = GCLK_GENCTRL_ID(2) | GCLK_GENCTRL_GENEN | GCLK_GENCTRL_SRC_OSCULP32K | GCLK_GENCTRL_DIVSEL;
+    while (GCLK->STATUS.bit.SYNCBUSY)
+        ;
+    GCLK->CLKCTRL.reg = GCLK_CLKCTRL_ID_WDT | GCLK_CLKCTRL_CLKEN | GCLK_CLKCTRL_GEN_GCLK2;
+    WDT->CTRL.reg = 0;
+    while (WDT->STATUS.bit.SYNCBUSY)
+        ;
+    WDT->CONFIG.reg = WDT_CONFIG_PER_4K;
+    WDT->EWCTRL.reg = WDT_EWCTRL_EWOFFSET_2K;
+    WDT->INTENSET.reg = WDT_INTENSET_EW;
+    NVIC_SetPriority(WDT_IRQn, 0);
+    NVIC_EnableIRQ(WDT_IRQn);
+    WDT->CTRL.reg = WDT_CTRL_ENABLE;
+    while (WDT->STATUS.bit.SYNCBUSY)
+        ;
+}
+
+void printOverruns(void)
+{
+    for (int stage = 0; stage < CT_STAGES; stage++)
+    {
+        Serial.print("overrun ");
+        Serial.print(stageNames[stage]);
+        Serial.print(' ');
+        Serial.println(forensics.overrunCts[stage]);
+    }
+    Serial.print("watchdog_warnings ");
+    Serial.println(forensics.watchdogCt);
+    Serial.print("last_overrun stage=");
+    Serial.print(stageNames[forensics.lastStage % CT_STAGES]);
+    Serial.print(" pc=0x");
+    Serial.print(forensics.lastPc, HEX);
+    Serial.print(" elapsed_ms=");
+    Serial.print(forensics.lastElapsedMs);
+    Serial.print(" watchdog=");
+    Serial.println(forensics.lastWasWatchdog);
+    Serial.print("reset_cause=0x");
+    Serial.println(resetCause, HEX);
+    Serial.print("forensics at=0x");
+    Serial.print((uint32_t)&forensics, HEX);
+    Serial.print(" noinit=");
+    Serial.println(forensicsKept);
+}
+
+// Streaming statistics over a series of samples in constant memory.
+// Everything but the running sums is derived at readout, so an event
+// costs a handful of adds and compares.
+struct RunningStat
+{
+    unsigned long count;
+    unsigned long long sum;
+    unsigned long long sumSquares;
+    unsigned long min;
+    unsigned long max;
+};
+
+void addSample(RunningStat &stat, unsigned long sample)
+{
+    if (stat.count == 0 || sample < stat.min)
+        stat.min = sample;
+    if (sample > stat.max)
+        stat.max = sample;
+    stat.count++;
+    stat.sum += sample;
+    stat.sumSquares += (unsigned long long)sample * sample;
+}
+
+// Statistic series, each kept per state.
+#define STAT_PAUSE_MS 0
+#define STAT_RESUME_DELAY_MS 1
+#define STAT_PAUSES_PER_INTERVAL 2
+#define STAT_ACTIVITY_MG_S 3
+#define STAT_ACTIVITY_PEAKS 4
+#define STAT_MATRIX_REDRAWS 5
+#define CT_STATS 6
+
+const char *statNames[CT_STATS] = {"pause_ms", "resume_delay_ms", "pauses_per_interval", "activity_mg_s", "activity_peaks", "matrix_redraws"};
+const char *stateNames[3] = {"work", "sbrk", "lbrk"};
+
+struct FocusStats
+{
+    RunningStat series[CT_STATS][3];
+};
+
+// Since boot, the current uptime day and the one before it.
+FocusStats lifetimeStats;
+FocusStats todayStats;
+FocusStats yesterdayStats;
+unsigned long todayStartMs = 0;
+
+// Pause length and resume delay distributions, exported for fleet-wide
+// quantiles (see tools/merge_sketches.cpp).
+DeviceSketch pauseSketch;
+DeviceSketch resumeDelaySketch;
+
+// Pauses in this interval.
+int intervalPauseCt = 0;
+unsigned long intervalPausedMs = 0;
+unsigned long intervalResumeDelayMs = 0;
+
+// Completed work intervals are kept in flash as two rings of 256-byte rows:
+// an index of per-tag summary snapshots, so per-project totals never need a
+// scan of the history, and a log of bit-packed session records.
+#define FLASH_ROW_BYTES 256
+#define TAG_INDEX_ROWS 2
+#define SESSION_LOG_ROWS 16
+#define TAG_INDEX_MAGIC 0x7a67
+
+// 16 bytes, so a row holds a whole number of snapshots.
+struct TagIndexEntry
+{
+    uint16_t magic;
+    // Sessions logged since the flash was formatted. Wraps in step with the
+    // log ring, whose size divides 2^16.
+    uint16_t sessionCt;
+    uint16_t pomoCts[CT_TAGS];
+};
+
+#define TAG_INDEX_SLOTS (TAG_INDEX_ROWS * FLASH_ROW_BYTES / sizeof(TagIndexEntry))
+#define SESSION_LOG_SLOTS (SESSION_LOG_ROWS * FLASH_ROW_BYTES / sizeof(uint32_t))
+
+// Session records are 32 bits: tag, mid-interval pauses, seconds paused and
+// seconds taken to start the interval, each saturating. Tags stop short of
+// all ones, so a record can never look like erased flash.
+#define RECORD_TAG_BITS 3
+#define RECORD_PAUSES_BITS 5
+#define RECORD_PAUSED_S_BITS 12
+#define RECORD_RESUME_S_BITS 12
+#define ERASED_WORD 0xffffffffUL
+
+#if CT_TAGS > (1 << RECORD_TAG_BITS) - 1
+#error "CT_TAGS does not fit in RECORD_TAG_BITS"
+#endif
+
+// Flash ends up zero filled after an upload, which tells loadTagIndex to format it.
+__attribute__((__aligned__(FLASH_ROW_BYTES))) static const uint8_t tagIndexFlash[TAG_INDEX_ROWS * FLASH_ROW_BYTES] = {};
+__attribute__((__aligned__(FLASH_ROW_BYTES))) static const uint8_t sessionLogFlash[SESSION_LOG_ROWS * FLASH_ROW_BYTES] = {};
+FlashClass flashWriter;
+
+// Slot of the latest index snapshot and the number of sessions logged.
+int tagIndexSlot = 0;
+uint16_t sessionCt = 0;
+
+// Flash is read through volatile pointers, the compiler believes it is all zeros.
+const volatile TagIndexEntry *tagIndexEntry(int slot)
+{
+    return (const volatile TagIndexEntry *)tagIndexFlash + slot;
+}
+
+const volatile uint32_t *sessionRecord(int slot)
+{
+    return (const volatile uint32_t *)sessionLogFlash + slot;
+}
+
+unsigned long saturate(unsigned long value, int bits)
+{
+    return min(value, (1UL << bits) - 1);
+}
+
+uint32_t packSessionRecord(int tag, unsigned long pauses, unsigned long pausedMs, unsigned long resumeDelayMs)
+{
+    uint32_t record = tag;
+    record |= saturate(pauses, RECORD_PAUSES_BITS) << RECORD_TAG_BITS;
+    record |= saturate(pausedMs / 1000, RECORD_PAUSED_S_BITS) << (RECORD_TAG_BITS + RECORD_PAUSES_BITS);
+    record |= saturate(resumeDelayMs / 1000, RECORD_RESUME_S_BITS) << (RECORD_TAG_BITS + RECORD_PAUSES_BITS + RECORD_PAUSED_S_BITS);
+    return record;
+}
+
+int sessionRecordTag(uint32_t record)
+{
+    return record & ((1 << RECORD_TAG_BITS) - 1);
+}
+
+// The slot after the latest record is always erased, so a record found
+// there at boot was appended without its snapshot. Rows are erased as soon
+// as the log reaches them rather than when their first slot is written,
+// since after the first lap they still hold records from the previous one.
+void eraseNextSessionRow(void)
+{
+    int slot = sessionCt % SESSION_LOG_SLOTS;
+    if (slot % (FLASH_ROW_BYTES / sizeof(uint32_t)) == 0)
+        flashWriter.erase(sessionRecord(slot), FLASH_ROW_BYTES);
+}
+
+void writeTagIndex(void)
+{
+    // Moving onto a new row erases it; the latest snapshot is still in the previous one.
+    tagIndexSlot = (tagIndexSlot + 1) % TAG_INDEX_SLOTS;
+    if (tagIndexSlot % (FLASH_ROW_BYTES / sizeof(TagIndexEntry)) == 0)
+        flashWriter.erase(tagIndexEntry(tagIndexSlot), FLASH_ROW_BYTES);
+
+    TagIndexEntry entry;
+    entry.magic = TAG_INDEX_MAGIC;
+    entry.sessionCt = sessionCt;
+    for (int tag = 0; tag < CT_TAGS; tag++)
+        entry.pomoCts[tag] = tagPomoCt[tag];
+    flashWriter.write(tagIndexEntry(tagIndexSlot), &entry, sizeof(entry));
+}
+
+// Restore the per-tag totals from the latest index snapshot, in O(slots).
+void loadTagIndex(void)
+{
+    int latest = -1;
+    for (int slot = 0; slot < (int)TAG_INDEX_SLOTS; slot++)
+    {
+        if (tagIndexEntry(slot)->magic != TAG_INDEX_MAGIC)
+            continue;
+        // Session counts wrap, so compare them in serial number arithmetic.
+        if (latest < 0 || (int16_t)(tagIndexEntry(slot)->sessionCt - tagIndexEntry(latest)->sessionCt) > 0)
+            latest = slot;
+    }
+
+    if (latest < 0)
+    {
+        // Fresh upload: format both rings and start from an empty snapshot.
+        flashWriter.erase(tagIndexFlash, sizeof(tagIndexFlash));
+        flashWriter.erase(sessionLogFlash, sizeof(sessionLogFlash));
+        sessionCt = 0;
+        for (int tag = 0; tag < CT_TAGS; tag++)
+            tagPomoCt[tag] = 0;
+        tagIndexSlot = TAG_INDEX_SLOTS - 1;
+        writeTagIndex();
+        return;
+    }
+
+    tagIndexSlot = latest;
+    sessionCt = tagIndexEntry(latest)->sessionCt;
+    for (int tag = 0; tag < CT_TAGS; tag++)
+        tagPomoCt[tag] = tagIndexEntry(latest)->pomoCts[tag];
+
+    // Power lost between appending a record and its snapshot: replay the record.
+    uint32_t record = *sessionRecord(sessionCt % SESSION_LOG_SLOTS);
+    if (record != ERASED_WORD && sessionRecordTag(record) < CT_TAGS)
+    {
+        tagPomoCt[sessionRecordTag(record)]++;
+        sessionCt++;
+        eraseNextSessionRow();
+        writeTagIndex();
+    }
+}
+
+// Append a completed work interval to the log and update the index.
+void logWorkSession(int tag, unsigned long pauses, unsigned long pausedMs, unsigned long resumeDelayMs)
+{
+    uint32_t record = packSessionRecord(tag, pauses, pausedMs, resumeDelayMs);
+    flashWriter.write(sessionRecord(sessionCt % SESSION_LOG_SLOTS), &record, sizeof(record));
+
+    // Erase ahead before the snapshot, so power lost in between replays the
+    // record at boot and erases again rather than finding an old one.
+    tagPomoCt[tag]++;
+    sessionCt++;
+    eraseNextSessionRow();
+    writeTagIndex();
+}
+
+// Print the session log oldest first as "session <tag> <pauses> <paused s> <resume delay s>".
+void printSessionLog(void)
+{
+    for (int i = 0; i < (int)SESSION_LOG_SLOTS; i++)
+    {
+        uint32_t record = *sessionRecord((sessionCt + i) % SESSION_LOG_SLOTS);
+        if (record == ERASED_WORD)
+            continue;
+        Serial.print("session ");
+        Serial.print(sessionRecordTag(record));
+        Serial.print(' ');
+        Serial.print((record >> RECORD_TAG_BITS) & ((1UL << RECORD_PAUSES_BITS) - 1));
+        Serial.print(' ');
+        Serial.print((record >> (RECORD_TAG_BITS + RECORD_PAUSES_BITS)) & ((1UL << RECORD_PAUSED_S_BITS) - 1));
+        Serial.print(' ');
+        Serial.println(record >> (RECORD_TAG_BITS + RECORD_PAUSES_BITS + RECORD_PAUSED_S_BITS));
+    }
+}
+
+// Roll the per-day statistics over, possibly across several idle days.
+void rollFocusDays(void)
+{
+    unsigned long now = millis();
+    while (now - todayStartMs >= DAY_MS)
+    {
+        yesterdayStats = todayStats;
+        todayStats = FocusStats();
+        todayStartMs += DAY_MS;
+    }
+}
+
+void addFocusSample(int series, int forState, unsigned long sample)
+{
+    rollFocusDays();
+    addSample(lifetimeStats.series[series][forState], sample);
+    addSample(todayStats.series[series][forState], sample);
+}
+
+// Print a statistic as count, min, max, mean (Q8 fixed point, shown to
+// two decimals) and standard deviation.
+void printRunningStat(const RunningStat &stat)
+{
+    Serial.print(" n=");
+    Serial.print(stat.count);
+    if (stat.count == 0)
+    {
+        Serial.println();
+        return;
+    }
+    unsigned long long meanQ8 = (stat.sum << 8) / stat.count;
+
+    // With sum = q * count + r, count * variance is
+    // sumSquares - q * (sum + r) - r * r / count, and no term is larger
+    // than sumSquares, so nothing is squared that could overflow.
+    unsigned long long q = stat.sum / stat.count;
+    unsigned long long r = stat.sum % stat.count;
+    unsigned long long spread = q * (stat.sum + r) + r * r / stat.count;
+    unsigned long long variance = stat.sumSquares > spread ? (stat.sumSquares - spread) / stat.count : 0;
+
+    // Integer square root, only ever run at readout.
+    unsigned long sd = 0;
+    for (unsigned long bit = 1UL << 31; bit; bit >>= 1)
+        if ((unsigned long long)(sd | bit) * (sd | bit) <= variance)
+            sd |= bit;
+
+    Serial.print(" min=");
+    Serial.print(stat.min);
+    Serial.print(" max=");
+    Serial.print(stat.max);
+    Serial.print(" mean=");
+    Serial.print((unsigned long)(meanQ8 >> 8));
+    Serial.print('.');
+    unsigned long hundredths = ((meanQ8 & 0xff) * 100) >> 8;
+    if (hundredths < 10)
+        Serial.print('0');
+    Serial.print(hundredths);
+    Serial.print(" sd=");
+    Serial.println(sd);
+}
+
+void printFocusStats(const char *period, const FocusStats &stats)
+{
+    for (int series = 0; series < CT_STATS; series++)
+    {
+        for (int forState = 0; forState < 3; forState++)
+        {
+            Serial.print(period);
+            Serial.print(' ');
+            Serial.print(statNames[series]);
+            Serial.print(' ');
+            Serial.print(stateNames[forState]);
+            printRunningStat(stats.series[series][forState]);
+        }
+    }
+}
+
+// Live telemetry for desk dashboards. A host subscribes to a set of fields
+// at a maximum rate and receives binary frames holding only the fields that
+// changed since the previous frame:
+//   0xa5, changed field mask, then for each changed field in bit order
+//   remaining - change in remaining milliseconds, zigzag varint
+//   status    - state | paused << 2 | on << 3 | tones << 4 | tag << 5
+//   pixels    - 16-bit little-endian mask of changed pixels, then RGB per changed pixel
+// The first frame after subscribing carries every subscribed field, with the
+// remaining time as a change from zero.
+#define TELEMETRY_SYNC 0xa5
+#define TELEMETRY_REMAINING 0x01
+#define TELEMETRY_STATUS 0x02
+#define TELEMETRY_PIXELS 0x04
+#define TELEMETRY_MAX_FRAME (2 + 5 + 1 + 2 + 3 * CT_NEOPIXELS)
+// CDC_ENDPOINT_IN in the SAMD core's USB/CDC.h. Serial.availableForWrite()
+// always reports a free packet there, so readiness is read off the endpoint.
+#define TELEMETRY_USB_IN_ENDPOINT 3
+
+uint8_t telemetryFields = 0;
+// Frames are spaced in microseconds, so 60 Hz is 16666 us and not 1000 / 60 ms.
+unsigned long telemetryIntervalUs = 0;
+unsigned long lastTelemetryUs = 0;
+bool telemetryKeyFrame = false;
+long sentRemainingMs = 0;
+uint8_t sentStatus = 0;
+uint32_t sentPixels[CT_NEOPIXELS];
+
+// Frames and bytes sent, and frames put off because the host had not yet
+// taken the previous packet.
+unsigned long telemetryFrameCt = 0;
+unsigned long telemetryByteCt = 0;
+unsigned long telemetryDeferredCt = 0;
+
+// Period of loop() while the timer runs, restarted by each subscription so
+// the cost of a telemetry rate can be read off the next 's' report. The
+// sum is 64-bit, a 32-bit one wraps after 71 minutes.
+unsigned long loopPeriodCt = 0;
+unsigned long long loopPeriodUs = 0;
+unsigned long loopPeriodMaxUs = 0;
+unsigned long lastLoopUs = 0;
+bool lastLoopRan = false;
+
+void subscribeTelemetry(uint8_t fields, uint8_t rateHz)
+{
+    telemetryFields = rateHz ? fields : 0;
+    telemetryIntervalUs = rateHz ? 1000000UL / rateHz : 0;
+    telemetryKeyFrame = true;
+    loopPeriodCt = 0;
+    loopPeriodUs = 0;
+    loopPeriodMaxUs = 0;
+}
+
+// Called at the top of loop(). Only periods of iterations that stepped the
+// timer count, not pause animation frames; loop() sets lastLoopRan.
+void countLoopPeriod(void)
+{
+    unsigned long now = micros();
+    if (lastLoopRan)
+    {
+        unsigned long period = now - lastLoopUs;
+        loopPeriodCt++;
+        loopPeriodUs += period;
+        loopPeriodMaxUs = max(loopPeriodMaxUs, period);
+    }
+    lastLoopUs = now;
+    lastLoopRan = false;
+}
+
+// The IN endpoint still holds a packet until the host polls for it; a
+// write then would wait for the host inside Serial.write.
+bool telemetryEndpointReady(void)
+{
+    return Serial && !USB->DEVICE.DeviceEndpoint[TELEMETRY_USB_IN_ENDPOINT].EPSTATUS.bit.BK1RDY;
+}
+
+int putVarint(uint8_t *out, long value)
+{
+    uint32_t zigzag = ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+    int length = 0;
+    while (zigzag >= 0x80)
+    {
+        out[length++] = (zigzag & 0x7f) | 0x80;
+        zigzag >>= 7;
+    }
+    out[length++] = zigzag;
+    return length;
+}
+
+// Send a frame if the rate allows, something changed and the host has taken the last packet.
+void sendTelemetry(void)
+{
+    unsigned long now = micros();
+    if (now - lastTelemetryUs < telemetryIntervalUs)
+        return;
+
+    uint8_t frame[TELEMETRY_MAX_FRAME];
+    uint8_t changed = 0;
+    int length = 2;
+
+    long remainingMs = timer.duration / 1000;
+    if ((telemetryFields & TELEMETRY_REMAINING) && (telemetryKeyFrame || remainingMs != sentRemainingMs))
+    {
+        changed |= TELEMETRY_REMAINING;
+        length += putVarint(frame + length, remainingMs - (telemetryKeyFrame ? 0 : sentRemainingMs));
+    }
+
+    uint8_t status = timer.state | controls.isPaused << 2 | controls.isOn << 3 | playTones << 4 | currentTag << 5;
+    if ((telemetryFields & TELEMETRY_STATUS) && (telemetryKeyFrame || status != sentStatus))
+    {
+        changed |= TELEMETRY_STATUS;
+        frame[length++] = status;
+    }
+
+    uint32_t pixels[CT_NEOPIXELS];
+    if (telemetryFields & TELEMETRY_PIXELS)
+    {
+        uint16_t changedPixels = 0;
+        int maskAt = length;
+        length += 2;
+        for (int i = 0; i < CT_NEOPIXELS; i++)
+        {
+            pixels[i] = CircuitPlayground.strip.getPixelColor(i);
+            if (!telemetryKeyFrame && pixels[i] == sentPixels[i])
+                continue;
+            changedPixels |= 1 << i;
+            frame[length++] = pixels[i] >> 16;
+            frame[length++] = pixels[i] >> 8;
+            frame[length++] = pixels[i];
+        }
+        if (changedPixels)
+        {
+            changed |= TELEMETRY_PIXELS;
+            frame[maskAt] = changedPixels;
+            frame[maskAt + 1] = changedPixels >> 8;
+        }
+        else
+            length -= 2;
+    }
+
+    if (!changed)
+        return;
+    if (!telemetryEndpointReady())
+    {
+        // Try again next iteration rather than blocking on the host.
+        telemetryDeferredCt++;
+        return;
+    }
+
+    frame[0] = TELEMETRY_SYNC;
+    frame[1] = changed;
+    Serial.write(frame, length);
+    telemetryFrameCt++;
+    telemetryByteCt += length;
+    lastTelemetryUs = now;
+    telemetryKeyFrame = false;
+    if (changed & TELEMETRY_REMAINING)
+        sentRemainingMs = remainingMs;
+    if (changed & TELEMETRY_STATUS)
+        sentStatus = status;
+    if (changed & TELEMETRY_PIXELS)
+        for (int i = 0; i < CT_NEOPIXELS; i++)
+            sentPixels[i] = pixels[i];
+}
+
+void printTelemetryCounts(void)
+{
+    Serial.print("telemetry frames=");
+    Serial.print(telemetryFrameCt);
+    Serial.print(" bytes=");
+    Serial.print(telemetryByteCt);
+    Serial.print(" deferred=");
+    Serial.println(telemetryDeferredCt);
+    Serial.print("loop iterations=");
+    Serial.print(loopPeriodCt);
+    Serial.print(" us_per_iteration=");
+    Serial.print(loopPeriodCt ? (unsigned long)(loopPeriodUs / loopPeriodCt) : 0UL);
+    Serial.print(" max_us=");
+    Serial.println(loopPeriodMaxUs);
+}
+
+void printSynthLoad(void)
+{
+    for (int voices = 0; voices <= SYNTH_VOICES; voices++)
+    {
+        Serial.print("synth voices=");
+        Serial.print(voices);
+        Serial.print(" refills=");
+        Serial.print(synthRefillCt[voices]);
+        Serial.print(" us_per_refill=");
+        Serial.println(synthRefillCt[voices] ? synthRefillUs[voices] / synthRefillCt[voices] : 0);
+    }
+}
+
+void printStatsReport(void)
+{
+    for (int tag = 0; tag < CT_TAGS; tag++)
+    {
+        Serial.print("tag ");
+        Serial.print(tag);
+        Serial.print(" pomodoros ");
+        Serial.println(tagPomoCt[tag]);
+    }
+    rollFocusDays();
+    printFocusStats("lifetime", lifetimeStats);
+    printFocusStats("today", todayStats);
+    printFocusStats("yesterday", yesterdayStats);
+    printSynthLoad();
+    printTelemetryCounts();
+    printActivitySampling();
+    printMatrixTransmits();
+}
+
+// Print a sketch as "sketch <name> <count> <level>:<item>,<item>..." for
+// each non-empty level.
+void printSketch(const char *name, const DeviceSketch &sketch)
+{
+    Serial.print("sketch ");
+    Serial.print(name);
+    Serial.print(' ');
+    Serial.print(sketch.count);
+    for (int level = 0; level < SKETCH_LEVELS; level++)
+    {
+        if (sketch.sizes[level] == 0)
+            continue;
+        Serial.print(' ');
+        Serial.print(level);
+        Serial.print(':');
+        for (int i = 0; i < sketch.sizes[level]; i++)
+        {
+            if (i > 0)
+                Serial.print(',');
+            Serial.print(sketch.items[level][i]);
+        }
+    }
+    Serial.println();
+}
+
+// Trace lines are "<event> <ms>", "transition <ms> <state>",
+// "pixels <ms> <state> <lit pixels>" and, when the event queue overflowed,
+// "dropped <ms> <events lost>". Tracing starts with a snapshot
+// "trace <ms> <state> <duration us> <cycle pomodoros> <lit pixels> <paused> <on>".
+void startTrace(void)
+{
+    Serial.print("trace ");
+    Serial.print(millis());
+    Serial.print(' ');
+    Serial.print(timer.state);
+    Serial.print(' ');
+    Serial.print(timer.duration);
+    Serial.print(' ');
+    Serial.print(timer.thisCyclePomoCt);
+    Serial.print(' ');
+    Serial.print(timer.numPixels);
+    Serial.print(' ');
+    Serial.print(controls.isPaused);
+    Serial.print(' ');
+    Serial.println(controls.isOn);
+    traceTail = traceHead;
+    traceDroppedReported = traceDroppedCt;
+    tracing = true;
+}
+
+void printTraceEvents(void)
+{
+    while (traceTail != traceHead)
+    {
+        Serial.print(traceEventNames[traceQueue[traceTail].type]);
+        Serial.print(' ');
+        Serial.println(traceQueue[traceTail].ms);
+        traceTail = (traceTail + 1) % TRACE_QUEUE_SIZE;
+    }
+    unsigned long dropped = traceDroppedCt;
+    if (dropped != traceDroppedReported)
+    {
+        Serial.print("dropped ");
+        Serial.print(millis());
+        Serial.print(' ');
+        Serial.println(dropped - traceDroppedReported);
+        traceDroppedReported = dropped;
+    }
+}
+
+void traceTimer(const char *what, bool withPixels)
+{
+    Serial.print(what);
+    Serial.print(' ');
+    Serial.print(millis());
+    Serial.print(' ');
+    Serial.print(timer.state);
+    if (withPixels)
+    {
+        Serial.print(' ');
+        Serial.print(timer.numPixels);
+    }
+    Serial.println();
+}
+
+// Arguments still expected by a multi-byte serial command.
+int commandArgsPending = 0;
+uint8_t commandArgs[2];
+
+// Serial commands are single characters, some followed by binary arguments:
+//   s - print the focus statistics report
+//   q - print the quantile sketches
+//   l - print the session log
+//   S <fields> <rate Hz> - subscribe to telemetry, a rate of 0 unsubscribes
+//   t - start or stop tracing events
+//   a - time an accelerometer register read, blocking and queued
+//   w - print loop overruns by stage and the last overrun, kept across resets
+//   f - start or stop dumping accelerometer FIFO batches
+void pollSerialCommands(void)
+{
+    if (!Serial.available())
+        return;
+    int received = Serial.read();
+    if (commandArgsPending > 0)
+    {
+        commandArgs[sizeof(commandArgs) - commandArgsPending--] = received;
+        if (commandArgsPending == 0)
+            subscribeTelemetry(commandArgs[0], commandArgs[1]);
+        return;
+    }
+    switch (received)
+    {
+    case 's':
+        printStatsReport();
+        break;
+    case 'q':
+        printSketch(statNames[STAT_PAUSE_MS], pauseSketch);
+        printSketch(statNames[STAT_RESUME_DELAY_MS], resumeDelaySketch);
+        break;
+    case 'l':
+        printSessionLog();
+        break;
+    case 'S':
+        commandArgsPending = 2;
+        break;
+    case 'a':
+        printAccelAccessTimes();
+        break;
+    case 'w':
+        printOverruns();
+        break;
+    case 'f':
+        fifoDumping = !fifoDumping;
+        break;
+    case 't':
+        if (tracing)
+            tracing = false;
+        else
+            startTrace();
+        break;
+    }
+}
 
 // Main app loop.
 void loop()
 {
-    if (!isOn)
+    beginLoopStage(STAGE_SERIAL);
+    countLoopPeriod();
+    pollSerialCommands();
+    setLoopStage(STAGE_TELEMETRY);
+    if (telemetryFields)
+        sendTelemetry();
+    if (tracing)
+        printTraceEvents();
+    if (fifoDumping)
+        printFifoDump();
+
+    int mode = controls.mode();
+    if (mode == LOOP_OFF)
     {
         // If off, turn off pixels :)
+        setLoopStage(STAGE_OFF);
+        CircuitPlayground.clearPixels();
+        if (matrixRedrawBelowUs != LONG_MAX)
+            clearMatrix();
+    }
+    else if (mode == LOOP_PAUSED)
+    {
+        // Draw number of completed pomodors for the current tag
+        // in binary in the tag color, then stream through all
+        // neopixels with current state color until user taps to resume.
+        setLoopStage(STAGE_PAUSED);
         CircuitPlayground.clearPixels();
+        drawNLightsBinaryWithColor(tagPomoCt[currentTag], tagColors[currentTag]);
+        delay(PAUSE_COUNT_MS);
+        for (int pixelIdx = 0; pixelIdx < timer.numPixels; pixelIdx++)
+        {
+            CircuitPlayground.setPixelColor(pixelIdx, color);
+            delay(PAUSE_PIXEL_MS);
+        }
+        delay(PAUSE_HOLD_MS);
     }
     else
     {
-        while (isPaused)
+        // The timer ignores the time passed while paused.
+        setLoopStage(STAGE_TIMER);
+        bool resumed;
+        unsigned long pausedMs;
+        noInterrupts();
+        bool tapped = controls.takeTaps(resumed, pausedMs);
+        interrupts();
+        if (resumed)
         {
-            // Draw number of completed pomodors in binary,
-            // then stream through all neopixels with current
-            // state color until user taps to resume.
-            CircuitPlayground.clearPixels();
-            drawNLightsBinaryWithColor(totalPomoCt, WORK_COLOR);
-            delay(424);
-            for (int pixelIdx = 0; pixelIdx < numPixels; pixelIdx++)
+            drawNLightsWithColor(timer.numPixels, color);
+
+            // A pause forced by a state transition measures how long the user
+            // took to start the next interval, any other one is a mid-interval pause.
+            if (controls.pausedByTransition)
+            {
+                addFocusSample(STAT_RESUME_DELAY_MS, timer.state, pausedMs);
+                resumeDelaySketch.add(pausedMs);
+                intervalResumeDelayMs = pausedMs;
+                controls.pausedByTransition = false;
+            }
+            else
             {
-                CircuitPlayground.setPixelColor(pixelIdx, color);
-                delay(42);
+                addFocusSample(STAT_PAUSE_MS, timer.state, pausedMs);
+                pauseSketch.add(pausedMs);
+                intervalPauseCt++;
+                intervalPausedMs += pausedMs;
             }
-            delay(242);
         }
 
-        // Compute time elapsed since last tick, and if unpaused,
-        // subtract from total time remaining for current state.
-        unsigned long thisMicros = micros();
-        unsigned long timePassed = thisMicros - lastMicros;
-        lastMicros = thisMicros;
+        lastLoopRan = true;
+        int changed = timer.step(micros(), tapped);
 
-        // Each loop computes a timePassed, but we want to ignore
-        // it if the device is paused.
-        if (didTogglePause)
+        // The matrix only changes when the minute shown does.
+        if (timer.duration < matrixRedrawBelowUs)
         {
-            drawNLightsWithColor(numPixels, color);
-            didTogglePause = false;
-            // Ignore the time passed while paused.
-            timePassed = 0;
+            setLoopStage(STAGE_MATRIX);
+            drawMatrixMinutes();
+            setLoopStage(STAGE_TIMER);
         }
 
-        // No state transition.
-        if (duration >= 0)
+        // Display num lights * (percent completed) for current state.
+        if (changed & STEP_PIXELS)
         {
-            // Display num lights * (percent completed) for current state.
-            // Scale the duration by 2**4 in order to prevent overflow.
-            numPixels = min(CT_NEOPIXELS, 1 + (CT_NEOPIXELS * (duration >> 4) / (durations[state] >> 4)));
-            if (numPixels != lastNumPixels)
-            {
-                drawNLightsWithColor(numPixels, color);
-                lastNumPixels = numPixels;
-            }
-            duration -= timePassed;
+            drawNLightsWithColor(timer.numPixels, color);
+            if (tracing)
+                traceTimer("pixels", true);
         }
 
         // State transition.
-        if (duration < 0)
+        if (changed & STEP_TRANSITION)
         {
-            if (state == 0)
+            setLoopStage(STAGE_TRANSITION);
+            addFocusSample(STAT_PAUSES_PER_INTERVAL, timer.completedState, intervalPauseCt);
+            if (timer.completedState == 0)
             {
-                // In work state.
-                thisCyclePomoCt++;
-                totalPomoCt++;
-                if (thisCyclePomoCt == NUM_WORK_BEFORE_LONG_BREAK)
-                {
-                    // Work -> Long Break
-                    thisCyclePomoCt = 0;
-                    state = 2;
-                }
-                else
-                {
-                    // Work -> Short Break
-                    state = 1;
-                }
-            }
-            else
-            {
-                // {Long Break || Short Break} -> Work
-                state = 0;
+                logWorkSession(currentTag, intervalPauseCt, intervalPausedMs, intervalResumeDelayMs);
+
+                noInterrupts();
+                unsigned long activitySum = activity.sum;
+                unsigned long activityPeakCt = activity.peakCt;
+                activity.sum = 0;
+                activity.peakCt = 0;
+                interrupts();
+                addFocusSample(STAT_ACTIVITY_MG_S, timer.completedState, activitySum / ACCEL_ODR_HZ);
+                addFocusSample(STAT_ACTIVITY_PEAKS, timer.completedState, activityPeakCt);
             }
 
-            // Update color, sound, duration for current state.
-            color = colors[state];
-            sound = sounds[state];
-            duration = durations[state];
+            intervalPauseCt = 0;
+            intervalPausedMs = 0;
+            intervalResumeDelayMs = 0;
 
-            // Play an end-of-state tone.
+            // Update color for current state.
+            color = colors[timer.state];
+            addFocusSample(STAT_MATRIX_REDRAWS, timer.completedState, intervalMatrixRedrawCt);
+            intervalMatrixRedrawCt = 0;
+            drawMatrixMinutes();
+
+            // Play an end-of-state chime.
             if (playTones)
-                CircuitPlayground.playTone(sound, SOUND_DURATION_MS);
+                playChime(timer.state);
             drawNLightsWithColor(10, color);
+            if (tracing)
+                traceTimer("transition", false);
 
             // We pause at each state transition to wait for user interaction.
-            isPaused = true;
-            numPixels = CT_NEOPIXELS;
+            noInterrupts();
+            controls.pauseForTransition(millis());
+            interrupts();
         }
     }
 }
@@ -210,26 +1760,40 @@ void loop()
 void setup(void)
 {
     CircuitPlayground.begin();
+    Serial.begin(SERIAL_BAUD);
+    timer.begin(durations, NUM_WORK_BEFORE_LONG_BREAK, micros());
+    loadTagIndex();
+    beginSynth();
 
     // I want the switch to be on if it's flipped right :)
     // but slideSwitch returns True if it's flipped left.
-    isOn = !CircuitPlayground.slideSwitch();
+    controls.begin(false, !CircuitPlayground.slideSwitch());
 
     // A tap toggles pause. ATTRIBUTION: Tap code from:
     // https://github.com/adafruit/Adafruit_CircuitPlayground/blob/master/examples/accelTap/accelTap.ino
 
-    CircuitPlayground.setAccelRange(LIS3DH_RANGE_2_G);
-    CircuitPlayground.setAccelTap(1, TAP_THRESHOLD_FORCE);
+    beginLis3dhAsync();
+    setAccelRange(LIS3DH_RANGE_2_G);
+    setAccelTap(TAP_THRESHOLD_FORCE);
+    beginActivitySampling();
     attachInterrupt(digitalPinToInterrupt(CPLAY_LIS3DH_INTERRUPT), togglePaused, FALLING);
 
     // Right button pressed, toggles playing end-of-cycle tones.
     attachInterrupt(digitalPinToInterrupt(5), togglePlayTones, FALLING);
 
+    // Left button pressed, picks the project tag while paused.
+    attachInterrupt(digitalPinToInterrupt(4), cycleTag, FALLING);
+
     // On-off switch.
     attachInterrupt(digitalPinToInterrupt(7), toggleIsOn, CHANGE);
 
     // Set NeoPixels to not be super-bright.
     CircuitPlayground.setBrightness(10);
+    matrix.begin();
+    matrix.setBrightness(10);
 
     drawNLightsWithColor(10, colors[0]);
+
+    // Last, so that the slow start-up above is not counted as an overrun.
+    beginWatchdog();
 }
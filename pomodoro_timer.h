@@ -0,0 +1,214 @@
+/**
+ * pomodoro_timer.h is the interval state machine that loop() runs: how time
+ * is counted off, when the pixel bar shrinks and which state follows which,
+ * and how taps and the switch pause, resume and turn it off. It has no hardware dependencies, so the host tools replay and simulate
+ * sessions with the same logic the board runs.
+ * */
+
+#ifndef POMODORO_TIMER_H
+#define POMODORO_TIMER_H
+
+// Number of lights available to illuminate on the board.
+// Circuit Playground Express has 10.
+#define CT_NEOPIXELS 10
+
+// 25 minutes work, 5 minutes short break, 15 minutes long break = 1500, 300, 900
+#define WORK_SECONDS 1500 // 25 minutes work = 1500 seconds
+#define WORK_US 1000000 * WORK_SECONDS
+
+#define SBRK_SECONDS 300 // 5 minutes break = 300 seconds
+#define SBRK_US 1000000 * SBRK_SECONDS
+
+#define LBRK_SECONDS 900 // 15 minutes long break = 900 seconds
+#define LBRK_US 1000000 * LBRK_SECONDS
+
+// number of work sessions before long break (usually 4)
+#define NUM_WORK_BEFORE_LONG_BREAK 4
+
+// What a call to PomodoroTimer::step changed.
+#define STEP_PIXELS 1
+#define STEP_TRANSITION 2
+
+struct PomodoroTimer
+{
+    // Length of each state in microseconds, and work intervals per long break.
+    long durations[3];
+    int workBeforeLongBreak;
+
+    // Hold counter state: one of work, short break, long break
+    short state;
+    long duration;
+    // State that ended at the last transition.
+    short completedState;
+
+    // Light up fraction of lights based on time passed
+    int numPixels;
+    int lastNumPixels;
+
+    // Pomodoros in cycle before long break
+    int thisCyclePomoCt;
+
+    // Time is tracked in ticks of microsecond precision.
+    unsigned long lastMicros;
+
+    void begin(const long stateDurations[3], int workIntervalsBeforeLongBreak, unsigned long nowMicros)
+    {
+        for (int i = 0; i < 3; i++)
+            durations[i] = stateDurations[i];
+        workBeforeLongBreak = workIntervalsBeforeLongBreak;
+        state = 0;
+        duration = durations[state];
+        completedState = 0;
+        numPixels = CT_NEOPIXELS;
+        lastNumPixels = CT_NEOPIXELS;
+        thisCyclePomoCt = 0;
+        lastMicros = nowMicros;
+    }
+
+    // One iteration of the running timer at nowMicros. Returns STEP_* flags.
+    // After a transition the bar is full again and the caller pauses.
+    int step(unsigned long nowMicros, bool resumed)
+    {
+        int changed = 0;
+
+        // Compute time elapsed since last tick, and subtract it from
+        // the total time remaining for the current state.
+        unsigned long timePassed = nowMicros - lastMicros;
+        lastMicros = nowMicros;
+
+        // Ignore the time passed while paused.
+        if (resumed)
+            timePassed = 0;
+
+        // No state transition.
+        if (duration >= 0)
+        {
+            // Display num lights * (percent completed) for current state.
+            // Scale the duration by 2**4 in order to prevent overflow.
+            int lit = 1 + (CT_NEOPIXELS * (duration >> 4) / (durations[state] >> 4));
+            numPixels = lit < CT_NEOPIXELS ? lit : CT_NEOPIXELS;
+            if (numPixels != lastNumPixels)
+            {
+                lastNumPixels = numPixels;
+                changed |= STEP_PIXELS;
+            }
+            duration -= timePassed;
+        }
+
+        // State transition.
+        if (duration < 0)
+        {
+            completedState = state;
+            if (state == 0)
+            {
+                // In work state.
+                thisCyclePomoCt++;
+                if (thisCyclePomoCt == workBeforeLongBreak)
+                {
+                    // Work -> Long Break
+                    thisCyclePomoCt = 0;
+                    state = 2;
+                }
+                else
+                {
+                    // Work -> Short Break
+                    state = 1;
+                }
+            }
+            else
+            {
+                // {Long Break || Short Break} -> Work
+                state = 0;
+            }
+            duration = durations[state];
+            numPixels = CT_NEOPIXELS;
+            changed |= STEP_TRANSITION;
+        }
+        return changed;
+    }
+};
+
+// The pause animation loop() draws, one frame per paused iteration: the
+// tag's pomodoro count in binary, then the bar one pixel at a time.
+#define PAUSE_COUNT_MS 424
+#define PAUSE_PIXEL_MS 42
+#define PAUSE_HOLD_MS 242
+
+// What an iteration of loop() does, from TimerControls::mode().
+#define LOOP_OFF 0
+#define LOOP_PAUSED 1
+#define LOOP_RUNNING 2
+
+// The user's controls as loop() sees them: the pause a tap toggles and the
+// on/off switch. The board's interrupt handlers and the host replay both
+// drive them, and both make loop()'s decisions through these methods.
+struct TimerControls
+{
+    volatile bool isPaused;
+    volatile bool isOn;
+    // A tap came since the last running iteration.
+    volatile bool didTogglePause;
+    // When the last pausing and resuming taps came, not when loop() noticed them.
+    volatile unsigned long pausedAtMs;
+    volatile unsigned long resumedAtMs;
+    // The current pause was forced by a state transition, so its length is
+    // how long the user took to start the next interval.
+    bool pausedByTransition;
+
+    void begin(bool paused, bool on)
+    {
+        isPaused = paused;
+        isOn = on;
+        didTogglePause = false;
+        pausedAtMs = 0;
+        resumedAtMs = 0;
+        pausedByTransition = false;
+    }
+
+    // From the tap interrupt.
+    void tap(unsigned long nowMs)
+    {
+        isPaused = !isPaused;
+        didTogglePause = true;
+        if (isPaused)
+            pausedAtMs = nowMs;
+        else
+            resumedAtMs = nowMs;
+    }
+
+    int mode(void) const
+    {
+        if (!isOn)
+            return LOOP_OFF;
+        return isPaused ? LOOP_PAUSED : LOOP_RUNNING;
+    }
+
+    // Once per running iteration, with the tap interrupt masked. Returns
+    // whether taps came since the last one, in which case the timer must not
+    // count the time since its last step. resumed is set if they ended a
+    // pause, which lasted pausedMs; a tap that paused again since mode()
+    // leaves it to the tap that ends that pause.
+    bool takeTaps(bool &resumed, unsigned long &pausedMs)
+    {
+        bool tapped = didTogglePause;
+        didTogglePause = false;
+        resumed = tapped && !isPaused;
+        pausedMs = resumedAtMs - pausedAtMs;
+        return tapped;
+    }
+
+    // After a transition loop() pauses until the user taps to start the next interval.
+    void pauseForTransition(unsigned long nowMs)
+    {
+        pausedAtMs = nowMs;
+        pausedByTransition = true;
+        isPaused = true;
+    }
+
+    static unsigned long pauseFrameMs(int numPixels)
+    {
+        return PAUSE_COUNT_MS + PAUSE_PIXEL_MS * numPixels + PAUSE_HOLD_MS;
+    }
+};
+
+#endif
@@ -0,0 +1,148 @@
+/**
+ * quantile_sketch.h is a fixed-size, mergeable quantile sketch in the style
+ * of KLL (Karnin, Lang, Liberty). It is shared by the firmware, which keeps
+ * one per distribution in static RAM, and by the host tools that merge the
+ * sketches exported by many boards.
+ * */
+
+#ifndef QUANTILE_SKETCH_H
+#define QUANTILE_SKETCH_H
+
+#include <stdint.h>
+
+// Level i holds up to CAPACITY items that each stand for 2^i samples.
+// When a level fills up it is sorted and every other item is promoted to
+// the next level, so the sketch never grows. Once the top level fills up
+// half of it is thrown away, which only happens after CAPACITY * 2^LEVELS
+// samples.
+template <int LEVELS, int CAPACITY>
+struct QuantileSketch
+{
+    uint32_t items[LEVELS][CAPACITY];
+    uint8_t sizes[LEVELS];
+    // Number of samples folded in, including those from merged sketches.
+    uint32_t count;
+    // Alternates which half of a level survives a compaction.
+    uint8_t coin;
+
+    void clear(void)
+    {
+        for (int level = 0; level < LEVELS; level++)
+            sizes[level] = 0;
+        count = 0;
+        coin = 0;
+    }
+
+    void add(uint32_t sample)
+    {
+        count++;
+        insert(0, sample);
+    }
+
+    // Insert an item standing for 2^level samples.
+    void insert(int level, uint32_t item)
+    {
+        if (level >= LEVELS)
+            level = LEVELS - 1;
+        items[level][sizes[level]++] = item;
+        if (sizes[level] == CAPACITY)
+            compact(level);
+    }
+
+    void sortLevel(int level)
+    {
+        // Insertion sort, levels are small and often nearly sorted.
+        uint32_t *levelItems = items[level];
+        for (int i = 1; i < sizes[level]; i++)
+        {
+            uint32_t item = levelItems[i];
+            int j = i - 1;
+            while (j >= 0 && levelItems[j] > item)
+            {
+                levelItems[j + 1] = levelItems[j];
+                j--;
+            }
+            levelItems[j + 1] = item;
+        }
+    }
+
+    void compact(int level)
+    {
+        sortLevel(level);
+        int size = sizes[level];
+        int offset = coin;
+        coin ^= 1;
+        if (level == LEVELS - 1)
+        {
+            // No level above: keep every other item in place.
+            int kept = 0;
+            for (int i = offset; i < size; i += 2)
+                items[level][kept++] = items[level][i];
+            sizes[level] = kept;
+            return;
+        }
+        sizes[level] = 0;
+        for (int i = offset; i < size; i += 2)
+            insert(level + 1, items[level][i]);
+    }
+
+    // Fold another sketch in; the two may have different dimensions.
+    template <int OTHER_LEVELS, int OTHER_CAPACITY>
+    void merge(const QuantileSketch<OTHER_LEVELS, OTHER_CAPACITY> &other)
+    {
+        count += other.count;
+        for (int level = 0; level < OTHER_LEVELS; level++)
+            for (int i = 0; i < other.sizes[level]; i++)
+                insert(level, other.items[level][i]);
+    }
+
+    // Total weight held by the sketch, equal to count until the top level
+    // has had to throw items away.
+    uint64_t weight(void) const
+    {
+        uint64_t total = 0;
+        for (int level = 0; level < LEVELS; level++)
+            total += (uint64_t)sizes[level] << level;
+        return total;
+    }
+
+    // Smallest item whose weighted rank reaches fraction q of the weight.
+    // Sorts each level in place, then walks them as a k-way merge.
+    uint32_t quantile(double q)
+    {
+        uint64_t total = weight();
+        if (total == 0)
+            return 0;
+        int heads[LEVELS];
+        for (int level = 0; level < LEVELS; level++)
+        {
+            sortLevel(level);
+            heads[level] = 0;
+        }
+        uint64_t target = (uint64_t)(q * (double)total);
+        uint64_t rank = 0;
+        uint32_t item = 0;
+        while (true)
+        {
+            int smallest = -1;
+            for (int level = 0; level < LEVELS; level++)
+                if (heads[level] < sizes[level] &&
+                    (smallest < 0 || items[level][heads[level]] < items[smallest][heads[smallest]]))
+                    smallest = level;
+            if (smallest < 0)
+                return item;
+            item = items[smallest][heads[smallest]++];
+            rank += (uint64_t)1 << smallest;
+            if (rank > target)
+                return item;
+        }
+    }
+};
+
+// The sketches each board keeps and exports. 12 levels of 16 items cover
+// 65536 samples in 788 bytes per sketch.
+#define SKETCH_LEVELS 12
+#define SKETCH_CAPACITY 16
+typedef QuantileSketch<SKETCH_LEVELS, SKETCH_CAPACITY> DeviceSketch;
+
+#endif
@@ -0,0 +1,179 @@
+/**
+ * synth.h is a small fixed-point wavetable synthesiser for the end-of-interval
+ * sounds. It renders 10-bit DAC codes, so the firmware can hand its buffers
+ * straight to DMA and the host tools can turn the same output into WAV files.
+ * */
+
+#ifndef SYNTH_H
+#define SYNTH_H
+
+#include <math.h>
+#include <stdint.h>
+
+#define SYNTH_SAMPLE_RATE 22050
+#define SYNTH_VOICES 2
+
+// One cycle of the waveform, indexed by the top bits of the phase.
+#define SYNTH_TABLE_BITS 8
+#define SYNTH_TABLE_SIZE (1 << SYNTH_TABLE_BITS)
+
+// Samples per buffer the firmware refills at a time, 11.6 ms at 22050 Hz.
+#define SYNTH_BUFFER_SAMPLES 256
+
+// The DAC is 10 bits; silence sits at mid scale.
+#define SYNTH_DAC_MID 512
+
+// Envelope levels are Q23 so that even slow ramps have a non-zero step.
+#define SYNTH_ENVELOPE_ONE (1L << 23)
+
+#define ENVELOPE_OFF 0
+#define ENVELOPE_ATTACK 1
+#define ENVELOPE_DECAY 2
+#define ENVELOPE_SUSTAIN 3
+#define ENVELOPE_RELEASE 4
+
+// Envelope timings in milliseconds, sustain as a fraction of full scale in Q23.
+struct Envelope
+{
+    int attackMs;
+    int decayMs;
+    int32_t sustainLevel;
+    int releaseMs;
+};
+
+struct SynthVoice
+{
+    uint32_t phase;
+    uint32_t increment;
+    uint8_t stage;
+    int32_t level;
+    // Samples left to hold the sustain level before releasing.
+    uint32_t holdSamples;
+    int32_t attackStep;
+    int32_t decayStep;
+    int32_t sustainLevel;
+    int32_t releaseStep;
+};
+
+struct Synth
+{
+    int16_t table[SYNTH_TABLE_SIZE];
+    SynthVoice voices[SYNTH_VOICES];
+
+    // Fill the wavetable with a sine and two soft harmonics, which carries
+    // better than a pure sine on the small speaker.
+    void init(void)
+    {
+        for (int i = 0; i < SYNTH_TABLE_SIZE; i++)
+        {
+            float angle = 2.0f * (float)M_PI * i / SYNTH_TABLE_SIZE;
+            float sample = 0.7f * sinf(angle) + 0.2f * sinf(2 * angle) + 0.1f * sinf(3 * angle);
+            table[i] = (int16_t)(32767.0f * sample);
+        }
+        for (int voice = 0; voice < SYNTH_VOICES; voice++)
+            voices[voice].stage = ENVELOPE_OFF;
+    }
+
+    static int32_t stepFor(int32_t span, int ms)
+    {
+        int32_t samples = (int32_t)((long)ms * SYNTH_SAMPLE_RATE / 1000);
+        return samples > 0 ? span / samples : span;
+    }
+
+    // Start a note on one voice; it releases after holdMs.
+    void noteOn(int voice, int frequency, int holdMs, const Envelope &envelope)
+    {
+        SynthVoice &v = voices[voice];
+        v.phase = 0;
+        v.increment = (uint32_t)(((uint64_t)frequency << 32) / SYNTH_SAMPLE_RATE);
+        v.level = 0;
+        v.holdSamples = (uint32_t)((long)holdMs * SYNTH_SAMPLE_RATE / 1000);
+        v.attackStep = stepFor(SYNTH_ENVELOPE_ONE, envelope.attackMs);
+        v.decayStep = stepFor(SYNTH_ENVELOPE_ONE - envelope.sustainLevel, envelope.decayMs);
+        v.sustainLevel = envelope.sustainLevel;
+        v.releaseStep = stepFor(envelope.sustainLevel, envelope.releaseMs);
+        v.stage = ENVELOPE_ATTACK;
+    }
+
+    bool active(void) const
+    {
+        for (int voice = 0; voice < SYNTH_VOICES; voice++)
+            if (voices[voice].stage != ENVELOPE_OFF)
+                return true;
+        return false;
+    }
+
+    // Advance one voice's envelope by a sample and return its level in Q15.
+    static int32_t envelopeTick(SynthVoice &v)
+    {
+        switch (v.stage)
+        {
+        case ENVELOPE_ATTACK:
+            v.level += v.attackStep;
+            if (v.level >= SYNTH_ENVELOPE_ONE)
+            {
+                v.level = SYNTH_ENVELOPE_ONE;
+                v.stage = ENVELOPE_DECAY;
+            }
+            break;
+        case ENVELOPE_DECAY:
+            v.level -= v.decayStep;
+            if (v.level <= v.sustainLevel)
+            {
+                v.level = v.sustainLevel;
+                v.stage = ENVELOPE_SUSTAIN;
+            }
+            break;
+        case ENVELOPE_SUSTAIN:
+            if (v.holdSamples == 0)
+                v.stage = ENVELOPE_RELEASE;
+            break;
+        case ENVELOPE_RELEASE:
+            v.level -= v.releaseStep;
+            if (v.level <= 0)
+            {
+                v.level = 0;
+                v.stage = ENVELOPE_OFF;
+            }
+            break;
+        }
+        if (v.holdSamples > 0)
+            v.holdSamples--;
+        return v.level >> 8;
+    }
+
+    // Render count DAC codes, mixing the voices at half scale each.
+    // Returns the number of voices that were sounding.
+    int render(uint16_t *out, int count)
+    {
+        int sounding = 0;
+        for (int voice = 0; voice < SYNTH_VOICES; voice++)
+            if (voices[voice].stage != ENVELOPE_OFF)
+                sounding++;
+        if (sounding == 0)
+        {
+            for (int i = 0; i < count; i++)
+                out[i] = SYNTH_DAC_MID;
+            return 0;
+        }
+
+        for (int i = 0; i < count; i++)
+        {
+            int32_t mix = 0;
+            for (int voice = 0; voice < SYNTH_VOICES; voice++)
+            {
+                SynthVoice &v = voices[voice];
+                if (v.stage == ENVELOPE_OFF)
+                    continue;
+                int32_t level = envelopeTick(v);
+                mix += (table[v.phase >> (32 - SYNTH_TABLE_BITS)] * level) >> 16;
+                v.phase += v.increment;
+            }
+            // Q15 to +/- half the 10-bit range.
+            out[i] = (uint16_t)(SYNTH_DAC_MID + (mix >> 6));
+        }
+        return sounding;
+    }
+};
+
+#endif
@@ -0,0 +1,186 @@
+/**
+ * activity_replay.cpp runs accelerometer FIFO batches dumped by the board
+ * (the 'f' serial command) through the firmware's activity reduction
+ * (activity.h). It checks that every batch gives the sum and peak count the
+ * board reported, prints the totals for other peak thresholds, and times
+ * the reduction per sample.
+ *
+ * Build: g++ -O2 -std=c++11 -o activity_replay tools/activity_replay.cpp
+ * Usage: activity_replay <dump file> [peak threshold mg per sample ...]
+ * Example: activity_replay tools/traces/fifo_synthetic.txt 31 125
+ *
+ * The dump is the serial output while dumping; lines other than
+ *   fifo <ms> <batch> <priming> <count> <sum mg> <peaks> <samples as hex>
+ * are ignored.
+ * */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../activity.h"
+
+struct Batch
+{
+    unsigned long ms;
+    unsigned long number;
+    bool priming;
+    int count;
+    unsigned long sum;
+    unsigned long peakCt;
+    std::vector<uint8_t> samples;
+};
+
+int hexDigit(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return -1;
+}
+
+bool loadDump(const char *path, std::vector<Batch> &batches)
+{
+    std::ifstream in(path);
+    if (!in)
+    {
+        perror(path);
+        return false;
+    }
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(in, line))
+    {
+        lineNumber++;
+        std::istringstream fields(line);
+        std::string kind, hex;
+        Batch batch;
+        int priming;
+        if (!(fields >> kind) || kind != "fifo")
+            continue;
+        if (!(fields >> batch.ms >> batch.number >> priming >> batch.count >> batch.sum >> batch.peakCt >> hex) ||
+            batch.count < 0 || batch.count > LIS3DH_FIFO_SAMPLES ||
+            hex.size() != (size_t)batch.count * LIS3DH_SAMPLE_BYTES * 2)
+        {
+            fprintf(stderr, "%s:%d: bad fifo line\n", path, lineNumber);
+            return false;
+        }
+        batch.priming = priming != 0;
+        for (size_t i = 0; i < hex.size(); i += 2)
+        {
+            int high = hexDigit(hex[i]), low = hexDigit(hex[i + 1]);
+            if (high < 0 || low < 0)
+            {
+                fprintf(stderr, "%s:%d: bad hex\n", path, lineNumber);
+                return false;
+            }
+            batch.samples.push_back(high << 4 | low);
+        }
+        batches.push_back(batch);
+    }
+    return true;
+}
+
+// Replay at the firmware's threshold and compare batch by batch. After a
+// batch the board skipped, the meter's last sample no longer matches the
+// board's, so that batch only resynchronises it.
+int checkAgainstBoard(const std::vector<Batch> &batches)
+{
+    ActivityMeter meter;
+    meter.begin(ACTIVITY_PEAK_THRESHOLD_MG);
+    int mismatchCt = 0, resyncCt = 0;
+    for (size_t i = 0; i < batches.size(); i++)
+    {
+        const Batch &batch = batches[i];
+        bool gap = i == 0 || batch.number != batches[i - 1].number + 1;
+        if (gap && !batch.priming)
+        {
+            if (batch.count)
+                meter.reduce(&batch.samples[0], batch.count, true);
+            resyncCt++;
+            continue;
+        }
+        unsigned long sumBefore = meter.sum, peakCtBefore = meter.peakCt;
+        meter.reduce(batch.count ? &batch.samples[0] : NULL, batch.count, batch.priming);
+        unsigned long sum = meter.sum - sumBefore, peakCt = meter.peakCt - peakCtBefore;
+        if (sum != batch.sum || peakCt != batch.peakCt)
+        {
+            mismatchCt++;
+            printf("batch %lu at %lu ms: board sum=%lu peaks=%lu, replay sum=%lu peaks=%lu\n", batch.number,
+                   batch.ms, batch.sum, batch.peakCt, sum, peakCt);
+        }
+    }
+    printf("batches=%zu resynced=%d mismatches=%d\n", batches.size(), resyncCt, mismatchCt);
+    return mismatchCt;
+}
+
+// Totals over the whole dump at one threshold, treating gaps as above.
+void replayThreshold(const std::vector<Batch> &batches, unsigned long thresholdMg)
+{
+    ActivityMeter meter;
+    meter.begin(thresholdMg);
+    int sampleCt = 0;
+    for (size_t i = 0; i < batches.size(); i++)
+    {
+        const Batch &batch = batches[i];
+        bool gap = i == 0 || batch.number != batches[i - 1].number + 1;
+        if (batch.count)
+            meter.reduce(&batch.samples[0], batch.count, batch.priming || gap);
+        if (!batch.priming && !gap)
+            sampleCt += batch.count;
+    }
+    printf("peak_mg=%lu samples=%d sum_mg=%lu peaks=%lu\n", thresholdMg, sampleCt, meter.sum, meter.peakCt);
+}
+
+// Time the reduction over the dumped batches, in ns per sample.
+double timeReduce(const std::vector<Batch> &batches)
+{
+    const int rounds = 2000;
+    ActivityMeter meter;
+    meter.begin(ACTIVITY_PEAK_THRESHOLD_MG);
+    long sampleCt = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int round = 0; round < rounds; round++)
+        for (size_t i = 0; i < batches.size(); i++)
+            if (batches[i].count)
+            {
+                meter.reduce(&batches[i].samples[0], batches[i].count, false);
+                sampleCt += batches[i].count;
+            }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (meter.sum == 0xffffffff)
+        printf("\n");
+    return sampleCt ? seconds * 1e9 / sampleCt : 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s <dump file> [peak threshold mg ...]\n", argv[0]);
+        return 2;
+    }
+    std::vector<Batch> batches;
+    if (!loadDump(argv[1], batches))
+        return 1;
+    if (batches.empty())
+    {
+        fprintf(stderr, "%s: no fifo lines\n", argv[1]);
+        return 1;
+    }
+
+    int mismatchCt = checkAgainstBoard(batches);
+    replayThreshold(batches, ACTIVITY_PEAK_THRESHOLD_MG);
+    for (int i = 2; i < argc; i++)
+        replayThreshold(batches, strtoul(argv[i], NULL, 10));
+    printf("reduce ns_per_sample=%.1f\n", timeReduce(batches));
+    return mismatchCt ? 1 : 0;
+}
@@ -0,0 +1,427 @@
+/**
+ * lis3dh_sim.cpp runs the firmware's I2C request queue (i2c_queue.h) against
+ * a simulated LIS3DH on a simulated bus: register reads and writes, auto-
+ * incrementing FIFO reads, a full queue, requests queued from callbacks, and
+ * a not-acknowledged address, lost arbitration, a bus error, an error
+ * interrupt in the middle of a request, stray interrupts on an idle bus and
+ * a device that holds the bus. Then it compares, in bus time, how
+ * long a caller is held up by a blocking read and by queueing one.
+ *
+ * Build: g++ -O2 -std=c++11 -o lis3dh_sim tools/lis3dh_sim.cpp
+ * Usage: lis3dh_sim [bus kHz]
+ * */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "../i2c_queue.h"
+
+// Must match the LIS3DH settings in pomodoro.cpp.
+#define LIS3DH_ADDRESS 0x19
+#define LIS3DH_AUTO_INCREMENT 0x80
+#define LIS3DH_REG_WHOAMI 0x0f
+#define LIS3DH_REG_CLICKTHS 0x3a
+#define LIS3DH_REG_OUT_X_L 0x28
+#define LIS3DH_FIFO_SAMPLES 32
+#define I2C_QUEUE_SIZE 8
+
+#define FAULT_NONE 0
+#define FAULT_NACK 1
+#define FAULT_ARBLOST 2
+#define FAULT_BUSERR 3
+#define FAULT_ERROR_IRQ 4
+// The device holds the bus: no interrupt ever comes.
+#define FAULT_HANG 5
+
+// The device and the bus in one: each bus operation takes effect on the
+// device at once and raises its interrupt one byte time later.
+struct SimLis3dh
+{
+    uint8_t registers[128];
+    uint8_t pointer;
+    bool autoIncrement;
+    // Bytes written since the last start: the first is the register address.
+    int written;
+    uint8_t received;
+
+    // Samples handed out by the output registers, which wrap around in FIFO mode.
+    int16_t nextSample;
+
+    double nowUs;
+    double byteUs;
+    bool locked;
+    uint8_t pendingFlags;
+    double pendingAtUs;
+    bool lastFailed;
+
+    // Inject a fault at the given byte of the bus, counting from 0.
+    int fault;
+    int faultAtByte;
+    int byteCt;
+    // Bytes the queue put on the bus after a failure, which it must never do.
+    int writesAfterFailure;
+    bool failedSinceStart;
+
+    void reset(double busKhz)
+    {
+        memset(registers, 0, sizeof(registers));
+        registers[LIS3DH_REG_WHOAMI] = 0x33;
+        pointer = 0;
+        autoIncrement = false;
+        written = 0;
+        nextSample = 0;
+        nowUs = 0;
+        byteUs = 9 * 1000.0 / busKhz;
+        locked = false;
+        pendingFlags = 0;
+        lastFailed = false;
+        fault = FAULT_NONE;
+        byteCt = 0;
+        writesAfterFailure = 0;
+        failedSinceStart = false;
+    }
+
+    void raise(uint8_t flags)
+    {
+        pendingFlags = flags;
+        pendingAtUs = nowUs + byteUs;
+    }
+
+    // Whether the current byte is the one to fail, and how.
+    int faultNow(void)
+    {
+        return fault != FAULT_NONE && byteCt++ == faultAtByte ? fault : FAULT_NONE;
+    }
+
+    uint8_t readRegister(void)
+    {
+        uint8_t value;
+        if (pointer >= LIS3DH_REG_OUT_X_L && pointer < LIS3DH_REG_OUT_X_L + 6)
+        {
+            // Axis i of sample n is n * 3 + i, left justified like the real thing.
+            int16_t sample = (int16_t)((nextSample * 3 + (pointer - LIS3DH_REG_OUT_X_L) / 2) << 4);
+            value = (pointer & 1) ? sample >> 8 : sample & 0xff;
+            if (pointer == LIS3DH_REG_OUT_X_L + 5)
+                nextSample++;
+        }
+        else
+            value = registers[pointer];
+        if (autoIncrement)
+            pointer = pointer == LIS3DH_REG_OUT_X_L + 5 ? LIS3DH_REG_OUT_X_L : (pointer + 1) & 0x7f;
+        return value;
+    }
+
+    void applyFault(int kind)
+    {
+        lastFailed = kind == FAULT_NACK || kind == FAULT_ARBLOST || kind == FAULT_BUSERR;
+        failedSinceStart = failedSinceStart || kind != FAULT_NONE;
+        if (kind == FAULT_HANG)
+            return;
+        raise(kind == FAULT_ERROR_IRQ ? I2C_FLAG_ERROR : I2C_FLAG_MB);
+    }
+
+    void start(uint8_t addressByte)
+    {
+        written = 0;
+        int kind = faultNow();
+        if (kind == FAULT_NONE && (addressByte >> 1) != LIS3DH_ADDRESS)
+            kind = FAULT_NACK;
+        if (kind != FAULT_NONE)
+        {
+            applyFault(kind);
+            return;
+        }
+        lastFailed = false;
+        if (addressByte & 1)
+        {
+            received = readRegister();
+            raise(I2C_FLAG_SB);
+        }
+        else
+            raise(I2C_FLAG_MB);
+    }
+
+    void write(uint8_t data)
+    {
+        if (failedSinceStart)
+            writesAfterFailure++;
+        int kind = faultNow();
+        if (kind != FAULT_NONE)
+        {
+            applyFault(kind);
+            return;
+        }
+        if (written++ == 0)
+        {
+            pointer = data & 0x7f;
+            autoIncrement = data & LIS3DH_AUTO_INCREMENT;
+        }
+        else
+        {
+            registers[pointer] = data;
+            if (autoIncrement)
+                pointer = (pointer + 1) & 0x7f;
+        }
+        lastFailed = false;
+        raise(I2C_FLAG_MB);
+    }
+
+    void ack(void)
+    {
+        int kind = faultNow();
+        if (kind == FAULT_ERROR_IRQ)
+        {
+            applyFault(kind);
+            return;
+        }
+        received = readRegister();
+        raise(I2C_FLAG_SB);
+    }
+
+    void stop(void)
+    {
+        pendingFlags = 0;
+        failedSinceStart = false;
+    }
+};
+
+SimLis3dh sim;
+
+struct SimBus
+{
+    void start(uint8_t addressByte) { sim.start(addressByte); }
+    void write(uint8_t data) { sim.write(data); }
+    uint8_t read(void) { return sim.received; }
+    void ack(void) { sim.ack(); }
+    void stop(void) { sim.stop(); }
+    bool failed(void) { return sim.lastFailed; }
+    void abort(void) { sim.stop(); }
+    uint32_t lock(void)
+    {
+        bool was = sim.locked;
+        sim.locked = true;
+        return was;
+    }
+    void unlock(uint32_t was) { sim.locked = was; }
+};
+
+I2cQueue<SimBus, I2C_QUEUE_SIZE> queue;
+
+// Deliver the pending interrupt, as the NVIC would once unmasked.
+bool deliver(void)
+{
+    if (!sim.pendingFlags || sim.locked)
+        return false;
+    uint8_t flags = sim.pendingFlags;
+    sim.pendingFlags = 0;
+    sim.nowUs = sim.pendingAtUs;
+    sim.locked = true;
+    queue.service(flags);
+    sim.locked = false;
+    return true;
+}
+
+void runUntilIdle(void)
+{
+    while (deliver())
+        ;
+}
+
+// Completed callbacks, in order.
+std::vector<int> results;
+void recordOk(bool ok) { results.push_back(ok ? 1 : 0); }
+
+// Blocking read as the firmware's shim does it: queue, then spin until done.
+bool blockingDone;
+bool blockingOk;
+void blockingCallback(bool ok)
+{
+    blockingOk = ok;
+    blockingDone = true;
+}
+
+bool blockingRead(uint8_t reg, uint8_t *data, uint8_t length)
+{
+    blockingDone = false;
+    if (!queue.read(reg, data, length, blockingCallback))
+        return false;
+    while (!blockingDone && deliver())
+        ;
+    return blockingDone && blockingOk;
+}
+
+int failures = 0;
+
+void check(bool ok, const char *what)
+{
+    printf("%s %s\n", ok ? "PASS" : "FAIL", what);
+    if (!ok)
+        failures++;
+}
+
+void resetAll(double busKhz)
+{
+    sim.reset(busKhz);
+    queue.begin(LIS3DH_ADDRESS, LIS3DH_AUTO_INCREMENT);
+    results.clear();
+}
+
+uint8_t chained[6];
+void chainRead(bool ok)
+{
+    recordOk(ok);
+    if (ok)
+        queue.read(LIS3DH_REG_OUT_X_L, chained, 6, recordOk);
+}
+
+void testRegisters(double busKhz)
+{
+    resetAll(busKhz);
+    uint8_t whoami = 0, threshold = 0;
+    check(blockingRead(LIS3DH_REG_WHOAMI, &whoami, 1) && whoami == 0x33, "read WHOAMI");
+    queue.write(LIS3DH_REG_CLICKTHS, 15, recordOk);
+    runUntilIdle();
+    check(blockingRead(LIS3DH_REG_CLICKTHS, &threshold, 1) && threshold == 15, "write then read back");
+}
+
+void testFifoRead(double busKhz)
+{
+    resetAll(busKhz);
+    uint8_t samples[LIS3DH_FIFO_SAMPLES * 6];
+    bool ok = blockingRead(LIS3DH_REG_OUT_X_L, samples, sizeof(samples));
+    bool match = true;
+    for (int i = 0; i < LIS3DH_FIFO_SAMPLES * 3; i++)
+        match = match && (int16_t)(samples[2 * i] | samples[2 * i + 1] << 8) >> 4 == i;
+    check(ok && match, "32 sample FIFO read wraps through the output registers");
+}
+
+void testQueueFull(double busKhz)
+{
+    resetAll(busKhz);
+    uint8_t data[I2C_QUEUE_SIZE];
+    int queued = 0;
+    sim.locked = true;
+    for (int i = 0; i < I2C_QUEUE_SIZE; i++)
+        queued += queue.read(LIS3DH_REG_WHOAMI, &data[i], 1, recordOk);
+    sim.locked = false;
+    runUntilIdle();
+    bool allOk = (int)results.size() == queued;
+    for (size_t i = 0; i < results.size(); i++)
+        allOk = allOk && results[i] == 1 && data[i] == 0x33;
+    check(queued == I2C_QUEUE_SIZE - 1 && allOk, "full queue refuses a request and runs the rest in order");
+}
+
+void testChained(double busKhz)
+{
+    resetAll(busKhz);
+    uint8_t source;
+    queue.read(LIS3DH_REG_WHOAMI, &source, 1, chainRead);
+    runUntilIdle();
+    check(results.size() == 2 && results[0] == 1 && results[1] == 1 &&
+              (int16_t)(chained[0] | chained[1] << 8) >> 4 == 0,
+          "request queued from a callback runs");
+}
+
+// A fault on the given byte fails that request only, and nothing more is
+// written once it has failed.
+void testFault(double busKhz, int fault, int atByte, const char *what)
+{
+    resetAll(busKhz);
+    sim.fault = fault;
+    sim.faultAtByte = atByte;
+    uint8_t data[2][2] = {{0, 0}, {0, 0}};
+    queue.read(LIS3DH_REG_WHOAMI, data[0], 2, recordOk);
+    queue.read(LIS3DH_REG_WHOAMI, data[1], 2, recordOk);
+    runUntilIdle();
+    check(results.size() == 2 && results[0] == 0 && results[1] == 1 && data[1][0] == 0x33 &&
+              sim.writesAfterFailure == 0,
+          what);
+}
+
+// A request the device never finishes is dropped by flush(), as the
+// firmware's blocking shim does on timeout, and the queue works again.
+void testHang(double busKhz)
+{
+    resetAll(busKhz);
+    sim.fault = FAULT_HANG;
+    sim.faultAtByte = 1;
+    uint8_t stuck[2], whoami = 0;
+    bool finished = blockingRead(LIS3DH_REG_WHOAMI, stuck, 2);
+    queue.flush();
+    sim.fault = FAULT_NONE;
+    check(!finished && queue.head == queue.tail && blockingRead(LIS3DH_REG_WHOAMI, &whoami, 1) && whoami == 0x33,
+          "request on a held bus is flushed, the next one runs");
+}
+
+// Interrupts on an idle bus are dropped without touching the queue, which
+// then still takes a full load of requests.
+void testStrayInterrupt(double busKhz, uint8_t flags, const char *what)
+{
+    resetAll(busKhz);
+    sim.locked = true;
+    queue.service(flags);
+    uint8_t data[I2C_QUEUE_SIZE];
+    int queued = 0;
+    for (int i = 0; i < I2C_QUEUE_SIZE; i++)
+        queued += queue.read(LIS3DH_REG_WHOAMI, &data[i], 1, recordOk);
+    sim.locked = false;
+    runUntilIdle();
+    bool allOk = (int)results.size() == queued;
+    for (size_t i = 0; i < results.size(); i++)
+        allOk = allOk && results[i] == 1 && data[i] == 0x33;
+    check(queue.head == queue.tail && queued == I2C_QUEUE_SIZE - 1 && allOk, what);
+}
+
+// Bus time a caller spends in one read, blocking and queued.
+void compareStalls(double busKhz)
+{
+    const int lengths[] = {1, 6, LIS3DH_FIFO_SAMPLES * 6};
+    uint8_t data[LIS3DH_FIFO_SAMPLES * 6];
+    for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++)
+    {
+        resetAll(busKhz);
+        double start = sim.nowUs;
+        blockingRead(LIS3DH_REG_OUT_X_L, data, lengths[i]);
+        double blockingUs = sim.nowUs - start;
+
+        // Queueing returns before the first byte is on the bus; the rest
+        // happens in the interrupt.
+        resetAll(busKhz);
+        const int repeats = 100000;
+        double queuedUs = 0;
+        std::chrono::steady_clock::duration submitTime(0);
+        for (int r = 0; r < repeats; r++)
+        {
+            start = sim.nowUs;
+            std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+            queue.read(LIS3DH_REG_OUT_X_L, data, lengths[i], NULL);
+            submitTime += std::chrono::steady_clock::now() - begin;
+            queuedUs += sim.nowUs - start;
+            runUntilIdle();
+        }
+        printf("read bytes=%d bus_khz=%.0f blocking_stall_us=%.0f queued_stall_us=%.0f host_submit_ns=%.0f\n",
+               lengths[i], busKhz, blockingUs, queuedUs / repeats,
+               std::chrono::duration<double>(submitTime).count() * 1e9 / repeats);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    double busKhz = argc > 1 ? atof(argv[1]) : 100;
+    testRegisters(busKhz);
+    testFifoRead(busKhz);
+    testQueueFull(busKhz);
+    testChained(busKhz);
+    testFault(busKhz, FAULT_NACK, 0, "address not acknowledged fails the request, the next one runs");
+    testFault(busKhz, FAULT_ARBLOST, 1, "lost arbitration fails the request, the next one runs");
+    testFault(busKhz, FAULT_BUSERR, 1, "bus error fails the request without writing on, the next one runs");
+    testFault(busKhz, FAULT_ERROR_IRQ, 3, "error interrupt while reading fails the request, the next one runs");
+    testHang(busKhz);
+    testStrayInterrupt(busKhz, I2C_FLAG_ERROR, "error interrupt on an idle bus leaves the queue empty");
+    testStrayInterrupt(busKhz, I2C_FLAG_MB, "master on bus interrupt on an idle bus leaves the queue empty");
+    compareStalls(busKhz);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,177 @@
+/**
+ * merge_sketches.cpp merges the quantile sketches exported by pomodoro
+ * boards (the lines printed for the 'q' serial command) and prints fleet-wide
+ * quantiles per distribution.
+ *
+ * Build: g++ -O2 -std=c++11 -pthread -o merge_sketches tools/merge_sketches.cpp
+ * Usage: merge_sketches [-j threads] capture.txt...
+ *        merge_sketches --selftest [devices] [samples per device]
+ * */
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+#include "../quantile_sketch.h"
+
+// Fleet sketches need more levels to hold many boards' worth of samples.
+typedef QuantileSketch<32, 64> FleetSketch;
+
+const double reportedQuantiles[] = {0.5, 0.9, 0.99};
+
+// Parse "sketch <name> <count> <level>:<item>,<item>... ..." into sketch.
+bool parseSketchLine(char *line, std::string &name, DeviceSketch &sketch)
+{
+    char *token = strtok(line, " \r\n");
+    if (!token || strcmp(token, "sketch") != 0)
+        return false;
+    char *nameToken = strtok(NULL, " \r\n");
+    char *countToken = strtok(NULL, " \r\n");
+    if (!nameToken || !countToken)
+        return false;
+    name = nameToken;
+    sketch.clear();
+    sketch.count = strtoul(countToken, NULL, 10);
+    while ((token = strtok(NULL, " \r\n")))
+    {
+        char *rest;
+        long level = strtol(token, &rest, 10);
+        if (*rest != ':' || level < 0 || level >= SKETCH_LEVELS)
+            return false;
+        for (char *item = strtok_r(rest + 1, ",", &rest); item; item = strtok_r(NULL, ",", &rest))
+        {
+            if (sketch.sizes[level] == SKETCH_CAPACITY)
+                return false;
+            sketch.items[level][sketch.sizes[level]++] = strtoul(item, NULL, 10);
+        }
+    }
+    return true;
+}
+
+// Merge sketches on threadCt threads, each folding a contiguous slice into
+// its own fleet sketch, then fold the partial sketches together.
+void mergeParallel(const std::vector<DeviceSketch> &sketches, int threadCt, FleetSketch &merged)
+{
+    std::vector<FleetSketch> partials(threadCt);
+    std::vector<std::thread> threads;
+    size_t slice = (sketches.size() + threadCt - 1) / threadCt;
+    for (int t = 0; t < threadCt; t++)
+    {
+        threads.push_back(std::thread([&, t]() {
+            partials[t].clear();
+            size_t end = std::min(sketches.size(), (t + 1) * slice);
+            for (size_t i = t * slice; i < end; i++)
+                partials[t].merge(sketches[i]);
+        }));
+    }
+    for (size_t t = 0; t < threads.size(); t++)
+        threads[t].join();
+    merged.clear();
+    for (int t = 0; t < threadCt; t++)
+        merged.merge(partials[t]);
+}
+
+void printQuantiles(const std::string &name, FleetSketch &merged)
+{
+    printf("%s n=%u", name.c_str(), merged.count);
+    for (size_t i = 0; i < sizeof(reportedQuantiles) / sizeof(reportedQuantiles[0]); i++)
+        printf(" p%g=%u", reportedQuantiles[i] * 100, merged.quantile(reportedQuantiles[i]));
+    printf("\n");
+}
+
+// Simulate a fleet with log-normal pause lengths, compare merged quantiles
+// against exact ones and time the merge at increasing thread counts.
+int selftest(int devices, int samplesPerDevice)
+{
+    std::mt19937 rng(42);
+    std::lognormal_distribution<double> pauseMs(std::log(90000.0), 1.0);
+    std::uniform_int_distribution<int> samplesJitter(samplesPerDevice / 2, samplesPerDevice * 3 / 2);
+
+    std::vector<DeviceSketch> sketches(devices);
+    std::vector<uint32_t> exact;
+    for (int d = 0; d < devices; d++)
+    {
+        sketches[d].clear();
+        int samples = samplesJitter(rng);
+        for (int i = 0; i < samples; i++)
+        {
+            uint32_t sample = (uint32_t)pauseMs(rng);
+            sketches[d].add(sample);
+            exact.push_back(sample);
+        }
+    }
+    std::sort(exact.begin(), exact.end());
+    printf("devices=%d samples=%zu sketch_bytes=%zu\n", devices, exact.size(), sizeof(DeviceSketch));
+
+    FleetSketch merged;
+    mergeParallel(sketches, 1, merged);
+    for (size_t i = 0; i < sizeof(reportedQuantiles) / sizeof(reportedQuantiles[0]); i++)
+    {
+        double q = reportedQuantiles[i];
+        uint32_t estimate = merged.quantile(q);
+        uint32_t truth = exact[(size_t)(q * exact.size())];
+        double rank = (double)(std::lower_bound(exact.begin(), exact.end(), estimate) - exact.begin()) / exact.size();
+        printf("p%g exact=%u sketch=%u rank_error=%.4f\n", q * 100, truth, estimate, std::fabs(rank - q));
+    }
+
+    int maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    // Doubling thread counts, ending at the core count whether or not it is a power of two.
+    for (int threadCt = 1;; threadCt = std::min(threadCt * 2, maxThreads))
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        mergeParallel(sketches, threadCt, merged);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        printf("threads=%d merge_s=%.4f sketches_per_s=%.0f\n", threadCt, seconds, devices / seconds);
+        if (threadCt == maxThreads)
+            break;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1 && strcmp(argv[1], "--selftest") == 0)
+        return selftest(argc > 2 ? atoi(argv[2]) : 1000, argc > 3 ? atoi(argv[3]) : 500);
+
+    int threadCt = std::max(1u, std::thread::hardware_concurrency());
+    std::map<std::string, std::vector<DeviceSketch> > byName;
+    char line[4096];
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+        {
+            threadCt = std::max(1, atoi(argv[++i]));
+            continue;
+        }
+        FILE *capture = fopen(argv[i], "r");
+        if (!capture)
+        {
+            perror(argv[i]);
+            return 1;
+        }
+        while (fgets(line, sizeof(line), capture))
+        {
+            std::string name;
+            DeviceSketch sketch;
+            if (parseSketchLine(line, name, sketch))
+                byName[name].push_back(sketch);
+        }
+        fclose(capture);
+    }
+
+    for (std::map<std::string, std::vector<DeviceSketch> >::iterator it = byName.begin(); it != byName.end(); ++it)
+    {
+        FleetSketch merged;
+        mergeParallel(it->second, threadCt, merged);
+        printQuantiles(it->first, merged);
+    }
+    return 0;
+}
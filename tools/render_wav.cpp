@@ -0,0 +1,109 @@
+/**
+ * render_wav.cpp renders the end-of-interval chimes with the firmware's
+ * synthesiser (synth.h) to WAV files for listening, and times the renderer
+ * per voice.
+ *
+ * Build: g++ -O2 -std=c++11 -o render_wav tools/render_wav.cpp
+ * Usage: render_wav [output directory]
+ * */
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "../chimes.h"
+#include "../synth.h"
+
+const char *stateNames[3] = {"work", "sbrk", "lbrk"};
+
+void putLE(FILE *out, uint32_t value, int bytes)
+{
+    for (int i = 0; i < bytes; i++)
+        fputc((value >> (8 * i)) & 0xff, out);
+}
+
+// Write 16-bit mono PCM, scaling the 10-bit DAC codes up.
+bool writeWav(const std::string &path, const std::vector<uint16_t> &codes)
+{
+    FILE *out = fopen(path.c_str(), "wb");
+    if (!out)
+        return false;
+    uint32_t dataBytes = codes.size() * 2;
+    fwrite("RIFF", 1, 4, out);
+    putLE(out, 36 + dataBytes, 4);
+    fwrite("WAVEfmt ", 1, 8, out);
+    putLE(out, 16, 4);
+    putLE(out, 1, 2);
+    putLE(out, 1, 2);
+    putLE(out, SYNTH_SAMPLE_RATE, 4);
+    putLE(out, SYNTH_SAMPLE_RATE * 2, 4);
+    putLE(out, 2, 2);
+    putLE(out, 16, 2);
+    fwrite("data", 1, 4, out);
+    putLE(out, dataBytes, 4);
+    for (size_t i = 0; i < codes.size(); i++)
+        putLE(out, (uint16_t)((int16_t)(codes[i] - SYNTH_DAC_MID) * 64), 2);
+    return fclose(out) == 0;
+}
+
+// Render buffers until the synthesiser goes quiet.
+std::vector<uint16_t> renderChime(Synth &synth, int forState)
+{
+    synth.noteOn(0, sounds[forState], SOUND_DURATION_MS, chimeEnvelope);
+    synth.noteOn(1, harmonies[forState], SOUND_DURATION_MS, chimeEnvelope);
+    std::vector<uint16_t> codes;
+    uint16_t buffer[SYNTH_BUFFER_SAMPLES];
+    while (synth.active())
+    {
+        synth.render(buffer, SYNTH_BUFFER_SAMPLES);
+        codes.insert(codes.end(), buffer, buffer + SYNTH_BUFFER_SAMPLES);
+    }
+    return codes;
+}
+
+// Time rendering with voiceCt voices held on, in ns per sample.
+double timeVoices(Synth &synth, int voiceCt)
+{
+    const int blocks = 20000;
+    uint16_t buffer[SYNTH_BUFFER_SAMPLES];
+    uint32_t checksum = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int block = 0; block < blocks; block++)
+    {
+        for (int voice = 0; voice < voiceCt; voice++)
+            if (synth.voices[voice].stage == ENVELOPE_OFF)
+                synth.noteOn(voice, sounds[voice], 1000, chimeEnvelope);
+        synth.render(buffer, SYNTH_BUFFER_SAMPLES);
+        checksum += buffer[block % SYNTH_BUFFER_SAMPLES];
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (checksum == 0xffffffff)
+        printf("\n");
+    return seconds * 1e9 / ((double)blocks * SYNTH_BUFFER_SAMPLES);
+}
+
+int main(int argc, char **argv)
+{
+    std::string directory = argc > 1 ? argv[1] : ".";
+    Synth synth;
+    synth.init();
+    for (int forState = 0; forState < 3; forState++)
+    {
+        std::vector<uint16_t> codes = renderChime(synth, forState);
+        std::string path = directory + "/chime_" + stateNames[forState] + ".wav";
+        if (!writeWav(path, codes))
+        {
+            perror(path.c_str());
+            return 1;
+        }
+        printf("%s %zu samples %.0f ms\n", path.c_str(), codes.size(), codes.size() * 1000.0 / SYNTH_SAMPLE_RATE);
+    }
+
+    for (int voiceCt = 0; voiceCt <= SYNTH_VOICES; voiceCt++)
+    {
+        synth.init();
+        printf("voices=%d ns_per_sample=%.1f\n", voiceCt, timeVoices(synth, voiceCt));
+    }
+    return 0;
+}
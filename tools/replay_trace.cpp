@@ -0,0 +1,207 @@
+/**
+ * replay_trace.cpp replays event traces recorded with the 't' serial command
+ * against the interval state machine the board runs (pomodoro_timer.h),
+ * driven by loop()'s own pause and switch handling (TimerControls) but on a
+ * virtual clock. It checks the
+ * replayed transitions and pixel bar changes against the recorded ones and
+ * reports replay throughput, so real traces double as regression tests and
+ * performance workloads.
+ *
+ * Build: g++ -O2 -std=c++11 -o replay_trace tools/replay_trace.cpp
+ * Usage: replay_trace [--loop-us N] [--tolerance-ms N] trace.txt...
+ * Example: replay_trace tools/traces/work_pause_break.txt
+ * */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "trace_file.h"
+
+// A recorded or replayed transition (pixels < 0) or pixel bar change.
+struct TimerChange
+{
+    unsigned long ms;
+    int state;
+    int pixels;
+};
+
+// Split a trace into the events that drive the replay and the changes it
+// should reproduce.
+void splitTimeline(const Trace &trace, std::vector<TraceEntry> &events, std::vector<TimerChange> &expected)
+{
+    for (size_t i = 0; i < trace.timeline.size(); i++)
+    {
+        const TraceEntry &entry = trace.timeline[i];
+        if (entry.type < CT_EVENTS)
+            events.push_back(entry);
+        else
+        {
+            TimerChange change = {entry.ms, entry.state, entry.pixels};
+            expected.push_back(change);
+        }
+    }
+}
+
+struct ReplayResult
+{
+    std::vector<TimerChange> changes;
+    unsigned long long iterations;
+};
+
+// Run loop() on a virtual clock: loopUs per running iteration, and one pause
+// animation per check of the paused flag, just as the board only notices a
+// resume tap once its animation has finished.
+void replay(const Trace &trace, const std::vector<TraceEntry> &events, unsigned long loopUs, unsigned long toleranceMs, ReplayResult &result)
+{
+    PomodoroTimer timer;
+    unsigned long long nowUs = (unsigned long long)trace.startMs * 1000;
+    timer.begin(durations, NUM_WORK_BEFORE_LONG_BREAK, (unsigned long)nowUs);
+    timer.state = trace.state;
+    timer.duration = trace.duration;
+    timer.thisCyclePomoCt = trace.cyclePomoCt;
+    timer.numPixels = trace.numPixels;
+    timer.lastNumPixels = trace.numPixels;
+
+    TimerControls controls;
+    controls.begin(trace.paused, trace.on);
+    size_t nextEvent = 0;
+    // Run on past the end so changes that come late within tolerance still
+    // show up, to the end of the last millisecond they may be stamped with.
+    unsigned long long endUs = (unsigned long long)(trace.endMs + toleranceMs + 1) * 1000 - 1;
+    result.iterations = 0;
+
+    while (nowUs <= endUs)
+    {
+        // The interrupt handlers.
+        while (nextEvent < events.size() && (unsigned long long)events[nextEvent].ms * 1000 <= nowUs)
+        {
+            const TraceEntry &event = events[nextEvent++];
+            if (event.type == EVENT_TAP)
+                controls.tap(event.ms);
+            else if (event.type == EVENT_OFF || event.type == EVENT_ON)
+                controls.isOn = event.type == EVENT_ON;
+        }
+        result.iterations++;
+
+        int mode = controls.mode();
+        if (mode == LOOP_OFF)
+        {
+            nowUs += loopUs;
+            continue;
+        }
+        if (mode == LOOP_PAUSED)
+        {
+            nowUs += TimerControls::pauseFrameMs(timer.numPixels) * 1000ULL;
+            continue;
+        }
+
+        bool resumed;
+        unsigned long pausedMs;
+        bool tapped = controls.takeTaps(resumed, pausedMs);
+        int changed = timer.step((unsigned long)nowUs, tapped);
+        unsigned long ms = (unsigned long)(nowUs / 1000);
+        if (changed & STEP_PIXELS)
+        {
+            TimerChange change = {ms, timer.state, timer.numPixels};
+            result.changes.push_back(change);
+        }
+        if (changed & STEP_TRANSITION)
+        {
+            TimerChange change = {ms, timer.state, -1};
+            result.changes.push_back(change);
+            controls.pauseForTransition(ms);
+        }
+        nowUs += loopUs;
+    }
+}
+
+void printChange(const char *label, const TimerChange &change)
+{
+    if (change.pixels < 0)
+        printf("  %s transition %lu %d\n", label, change.ms, change.state);
+    else
+        printf("  %s pixels %lu %d %d\n", label, change.ms, change.state, change.pixels);
+}
+
+// Compare replayed against recorded changes in order, ignoring replayed
+// changes after the end of the trace. Returns the mismatch count.
+int compare(const std::vector<TimerChange> &expected, const std::vector<TimerChange> &replayed,
+            unsigned long endMs, unsigned long toleranceMs)
+{
+    int mismatches = 0;
+    size_t count = std::max(expected.size(), replayed.size());
+    for (size_t i = 0; i < count; i++)
+    {
+        if (i >= expected.size() && replayed[i].ms > endMs)
+            break;
+        bool match = i < expected.size() && i < replayed.size() && expected[i].state == replayed[i].state &&
+                     expected[i].pixels == replayed[i].pixels &&
+                     (expected[i].ms > replayed[i].ms ? expected[i].ms - replayed[i].ms : replayed[i].ms - expected[i].ms) <= toleranceMs;
+        if (match)
+            continue;
+        if (mismatches++ < 5)
+        {
+            printf("mismatch at change %zu\n", i);
+            if (i < expected.size())
+                printChange("recorded", expected[i]);
+            if (i < replayed.size())
+                printChange("replayed", replayed[i]);
+        }
+    }
+    return mismatches;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long loopUs = 100;
+    // Resumes are only noticed once per pause animation, up to ~1.1 s late.
+    unsigned long toleranceMs = 1500;
+    int failed = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--loop-us") == 0 && i + 1 < argc)
+        {
+            loopUs = std::max(1L, atol(argv[++i]));
+            continue;
+        }
+        if (strcmp(argv[i], "--tolerance-ms") == 0 && i + 1 < argc)
+        {
+            toleranceMs = atol(argv[++i]);
+            continue;
+        }
+
+        Trace trace;
+        if (!loadTrace(argv[i], trace))
+        {
+            perror(argv[i]);
+            return 1;
+        }
+        if (trace.droppedCt)
+        {
+            // Without them the replay cannot match, and mismatches would hide why.
+            printf("%s FAILED: %lu events were dropped while recording\n", argv[i], trace.droppedCt);
+            failed++;
+            continue;
+        }
+        std::vector<TraceEntry> events;
+        std::vector<TimerChange> expected;
+        splitTimeline(trace, events, expected);
+        ReplayResult result;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        replay(trace, events, loopUs, toleranceMs, result);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        int mismatches = compare(expected, result.changes, trace.endMs, toleranceMs);
+        double traceSeconds = (trace.endMs - trace.startMs) / 1000.0;
+        printf("%s events=%zu changes=%zu/%zu mismatches=%d iterations=%llu iterations_per_s=%.3g speedup=%.0fx\n",
+               argv[i], events.size(), result.changes.size(), expected.size(), mismatches,
+               result.iterations, result.iterations / seconds, traceSeconds / seconds);
+        if (mismatches)
+            failed++;
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,509 @@
+/**
+ * schedule_optimizer.cpp asks which interval lengths suit how a user actually
+ * behaves. It fits a behaviour model from event traces recorded with the 't'
+ * serial command: how often work is paused at each point of an interval, how
+ * long pauses last, and how late the next interval is started. Then it runs
+ * a grid of candidate schedules through the interval state machine the board
+ * runs (pomodoro_timer.h) on a virtual clock, many simulated days each, and
+ * prints the schedules with the most completed focus time per day.
+ *
+ * A work interval broken by a pause of --abandon-min or more counts as
+ * abandoned and earns no focus time. That is what longer intervals cost: the
+ * fitted pause rate at each point of an interval decides how likely one is
+ * to survive to its end.
+ *
+ * Build: g++ -O2 -std=c++11 -pthread -o schedule_optimizer tools/schedule_optimizer.cpp
+ * Usage: schedule_optimizer [-j threads] [--days N] [--day-hours N] [--top N] [--abandon-min N] trace.txt...
+ * Example: schedule_optimizer tools/traces/late_pauses.txt
+ *        schedule_optimizer --bench [trace.txt...]
+ * */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "trace_file.h"
+
+// The pause rate during work is fitted per 5 minutes into the interval;
+// past the last bucket the last rate holds.
+#define HAZARD_BUCKET_MS 300000.0
+#define HAZARD_BUCKETS 8
+
+// The board holds durations in a 32-bit long of microseconds, which holds
+// up to 35.79 minutes, so 35 is the longest whole-minute length.
+#define MAX_INTERVAL_MIN 35
+
+// Pauses at least this long abandon the work interval they break.
+#define ABANDON_PAUSE_MIN 5
+
+struct BehaviourModel
+{
+    // Running work time and pauses in each bucket, and the same for breaks.
+    double workExposureMs[HAZARD_BUCKETS];
+    unsigned long workPauseCts[HAZARD_BUCKETS];
+    double breakExposureMs;
+    unsigned long breakPauseCt;
+
+    // Pause lengths, and delays before starting the interval after a work
+    // interval and after a break.
+    std::vector<unsigned long> pauseMs;
+    std::vector<unsigned long> resumeDelayMs[2];
+
+    // Pauses per millisecond of running time, from finish().
+    double workRates[HAZARD_BUCKETS];
+    double breakRate;
+
+    // Pauses this long or longer abandon a work interval.
+    unsigned long abandonPauseMs;
+
+    void clear(void)
+    {
+        for (int bucket = 0; bucket < HAZARD_BUCKETS; bucket++)
+        {
+            workExposureMs[bucket] = 0;
+            workPauseCts[bucket] = 0;
+        }
+        breakExposureMs = 0;
+        breakPauseCt = 0;
+        pauseMs.clear();
+        resumeDelayMs[0].clear();
+        resumeDelayMs[1].clear();
+        abandonPauseMs = ABANDON_PAUSE_MIN * 60000UL;
+    }
+
+    // Fraction of the sampled pauses that abandon a work interval.
+    double abandonFraction(void) const
+    {
+        size_t abandoning = 0;
+        for (size_t i = 0; i < pauseMs.size(); i++)
+            abandoning += pauseMs[i] >= abandonPauseMs;
+        return pauseMs.empty() ? 0 : (double)abandoning / pauseMs.size();
+    }
+
+    // Count running time from elapsedMs into an interval of the given state.
+    void addExposure(int state, double elapsedMs, double spanMs)
+    {
+        if (state != 0)
+        {
+            breakExposureMs += spanMs;
+            return;
+        }
+        while (spanMs > 0)
+        {
+            int bucket = std::min(HAZARD_BUCKETS - 1, (int)(elapsedMs / HAZARD_BUCKET_MS));
+            double inBucket = bucket == HAZARD_BUCKETS - 1 ? spanMs : (bucket + 1) * HAZARD_BUCKET_MS - elapsedMs;
+            inBucket = std::min(inBucket, spanMs);
+            workExposureMs[bucket] += inBucket;
+            elapsedMs += inBucket;
+            spanMs -= inBucket;
+        }
+    }
+
+    void addPause(int state, double elapsedMs)
+    {
+        if (state == 0)
+            workPauseCts[std::min(HAZARD_BUCKETS - 1, (int)(elapsedMs / HAZARD_BUCKET_MS))]++;
+        else
+            breakPauseCt++;
+    }
+
+    // Turn counts into rates. Buckets nobody reached borrow the rate of the
+    // bucket before them, or the overall rate if there is none.
+    void finish(void)
+    {
+        double exposure = 0;
+        unsigned long pauses = 0;
+        for (int bucket = 0; bucket < HAZARD_BUCKETS; bucket++)
+        {
+            exposure += workExposureMs[bucket];
+            pauses += workPauseCts[bucket];
+        }
+        double rate = exposure > 0 ? pauses / exposure : 0;
+        for (int bucket = 0; bucket < HAZARD_BUCKETS; bucket++)
+        {
+            if (workExposureMs[bucket] >= HAZARD_BUCKET_MS)
+                rate = workPauseCts[bucket] / workExposureMs[bucket];
+            workRates[bucket] = rate;
+        }
+        breakRate = breakExposureMs > 0 ? breakPauseCt / breakExposureMs : 0;
+    }
+
+    // Running time until the next pause, from elapsedUs into an interval of
+    // the given state. Walks the piecewise constant rate until an
+    // exponentially distributed amount of it has been used up.
+    unsigned long long nextPauseUs(int state, long elapsedUs, std::mt19937 &rng) const
+    {
+        double target = std::exponential_distribution<double>(1.0)(rng);
+        if (state != 0)
+            return breakRate > 0 ? (unsigned long long)(target / breakRate * 1000) : ULLONG_MAX;
+        double elapsedMs = elapsedUs / 1000.0;
+        double offsetMs = 0;
+        for (int bucket = std::min(HAZARD_BUCKETS - 1, (int)(elapsedMs / HAZARD_BUCKET_MS));; bucket++)
+        {
+            double rate = workRates[bucket];
+            if (bucket == HAZARD_BUCKETS - 1)
+                return rate > 0 ? (unsigned long long)((offsetMs + target / rate) * 1000) : ULLONG_MAX;
+            double spanMs = (bucket + 1) * HAZARD_BUCKET_MS - (elapsedMs + offsetMs);
+            if (rate > 0 && rate * spanMs >= target)
+                return (unsigned long long)((offsetMs + target / rate) * 1000);
+            target -= rate * spanMs;
+            offsetMs += spanMs;
+        }
+    }
+
+    static unsigned long long resampleUs(const std::vector<unsigned long> &samples, std::mt19937 &rng)
+    {
+        if (samples.empty())
+            return 0;
+        return samples[std::uniform_int_distribution<size_t>(0, samples.size() - 1)(rng)] * 1000ULL;
+    }
+};
+
+// Walk a trace the way the board saw it and add its pauses, pause lengths,
+// resume delays and running time to the model.
+bool fitTrace(const char *path, BehaviourModel &model)
+{
+    Trace trace;
+    if (!loadTrace(path, trace))
+        return false;
+    if (trace.droppedCt)
+    {
+        // Lost taps would turn pauses into work and the other way round.
+        fprintf(stderr, "%s: skipped, %lu events were dropped while recording\n", path, trace.droppedCt);
+        return true;
+    }
+    const std::vector<TraceEntry> &timeline = trace.timeline;
+    if (timeline.empty())
+        return true;
+
+    int state = trace.state;
+    bool paused = trace.paused, on = trace.on;
+    double elapsedMs = (durations[state] - trace.duration) / 1000.0;
+    unsigned long sinceMs = trace.startMs;
+    // How long the snapshot pause had lasted is unknown, so it is not sampled.
+    bool pauseKnown = false;
+    bool pausedByTransition = false;
+    unsigned long pausedAtMs = 0;
+    int completedState = 0;
+
+    for (size_t i = 0; i < timeline.size(); i++)
+    {
+        const TraceEntry &entry = timeline[i];
+        if (on && !paused)
+        {
+            model.addExposure(state, elapsedMs, (double)(entry.ms - sinceMs));
+            elapsedMs += entry.ms - sinceMs;
+        }
+        sinceMs = entry.ms;
+
+        switch (entry.type)
+        {
+        case EVENT_TAP:
+            if (paused)
+            {
+                if (pauseKnown && pausedByTransition)
+                    model.resumeDelayMs[completedState == 0 ? 0 : 1].push_back(entry.ms - pausedAtMs);
+                else if (pauseKnown)
+                    model.pauseMs.push_back(entry.ms - pausedAtMs);
+                paused = false;
+            }
+            else
+            {
+                model.addPause(state, elapsedMs);
+                paused = true;
+                pauseKnown = true;
+                pausedByTransition = false;
+                pausedAtMs = entry.ms;
+            }
+            break;
+        case EVENT_TRANSITION:
+            completedState = state;
+            state = entry.state;
+            elapsedMs = 0;
+            paused = true;
+            pauseKnown = true;
+            pausedByTransition = true;
+            pausedAtMs = entry.ms;
+            break;
+        case EVENT_OFF:
+            on = false;
+            break;
+        case EVENT_ON:
+            on = true;
+            break;
+        }
+    }
+    return true;
+}
+
+// A model with made-up but plausible behaviour, for benchmarking without
+// traces: pauses get likelier the longer work runs, breaks overrun.
+void syntheticModel(BehaviourModel &model)
+{
+    std::mt19937 rng(42);
+    std::lognormal_distribution<double> pauseMs(std::log(90000.0), 1.0);
+    std::lognormal_distribution<double> afterWorkMs(std::log(20000.0), 0.8);
+    std::lognormal_distribution<double> afterBreakMs(std::log(120000.0), 1.0);
+    model.clear();
+    for (int bucket = 0; bucket < HAZARD_BUCKETS; bucket++)
+    {
+        model.workExposureMs[bucket] = 100 * HAZARD_BUCKET_MS;
+        model.workPauseCts[bucket] = 5 + 5 * bucket;
+    }
+    model.breakExposureMs = 100 * HAZARD_BUCKET_MS;
+    model.breakPauseCt = 5;
+    for (int i = 0; i < 500; i++)
+    {
+        model.pauseMs.push_back((unsigned long)pauseMs(rng));
+        model.resumeDelayMs[0].push_back((unsigned long)afterWorkMs(rng));
+        model.resumeDelayMs[1].push_back((unsigned long)afterBreakMs(rng));
+    }
+    model.finish();
+}
+
+struct Schedule
+{
+    int workMin;
+    int shortBreakMin;
+    int longBreakMin;
+    int workBeforeLongBreak;
+
+    // Filled in by evaluate().
+    double focusMinPerDay;
+    double focusMinStdErr;
+    double workPerDay;
+    double pausesPerWork;
+    double abandonedPerDay;
+};
+
+// Run one simulated day. Like loop(), the timer is stepped without
+// resuming when a pause starts and with it when the pause ends; in between
+// the virtual clock jumps straight to the next pause or transition. Work
+// intervals that a long pause abandoned still run out, as on the board, but
+// count in abandoned rather than workDone.
+void simulateDay(const BehaviourModel &model, const long scheduleDurations[3], int workBeforeLongBreak,
+                 unsigned long long dayUs, std::mt19937 &rng, int &workDone, int &pauses, int &abandoned)
+{
+    PomodoroTimer timer;
+    unsigned long long nowUs = 0;
+    timer.begin(scheduleDurations, workBeforeLongBreak, (unsigned long)nowUs);
+    workDone = 0;
+    pauses = 0;
+    abandoned = 0;
+    bool intervalAbandoned = false;
+    while (nowUs < dayUs)
+    {
+        long elapsedUs = timer.durations[timer.state] - timer.duration;
+        unsigned long long pauseInUs = model.nextPauseUs(timer.state, elapsedUs, rng);
+        unsigned long long transitionInUs = (unsigned long long)timer.duration + 1;
+        if (pauseInUs < transitionInUs)
+        {
+            nowUs += pauseInUs;
+            timer.step((unsigned long)nowUs, false);
+            unsigned long long pauseUs = BehaviourModel::resampleUs(model.pauseMs, rng);
+            if (timer.state == 0)
+            {
+                pauses++;
+                intervalAbandoned = intervalAbandoned || pauseUs >= model.abandonPauseMs * 1000ULL;
+            }
+            nowUs += pauseUs;
+            timer.step((unsigned long)nowUs, true);
+            continue;
+        }
+
+        nowUs += transitionInUs;
+        if (nowUs > dayUs)
+            break;
+        int changed = timer.step((unsigned long)nowUs, false);
+        if ((changed & STEP_TRANSITION) && timer.completedState == 0)
+        {
+            if (intervalAbandoned)
+                abandoned++;
+            else
+                workDone++;
+            intervalAbandoned = false;
+        }
+        // Paused until the user starts the next interval.
+        nowUs += BehaviourModel::resampleUs(model.resumeDelayMs[timer.completedState == 0 ? 0 : 1], rng);
+        timer.step((unsigned long)nowUs, true);
+    }
+}
+
+// Every schedule sees the same days: day d draws from a generator seeded
+// with d, so differences between schedules are not sampling noise.
+void evaluate(const BehaviourModel &model, Schedule &schedule, int days, unsigned long long dayUs)
+{
+    long scheduleDurations[3] = {schedule.workMin * 60000000L, schedule.shortBreakMin * 60000000L,
+                                 schedule.longBreakMin * 60000000L};
+    double sum = 0, sumSquares = 0;
+    long workDoneTotal = 0, pausesTotal = 0, abandonedTotal = 0;
+    for (int day = 0; day < days; day++)
+    {
+        std::mt19937 rng(day);
+        int workDone, pauses, abandoned;
+        simulateDay(model, scheduleDurations, schedule.workBeforeLongBreak, dayUs, rng, workDone, pauses, abandoned);
+        double focusMin = (double)workDone * schedule.workMin;
+        sum += focusMin;
+        sumSquares += focusMin * focusMin;
+        workDoneTotal += workDone;
+        pausesTotal += pauses;
+        abandonedTotal += abandoned;
+    }
+    schedule.focusMinPerDay = sum / days;
+    double variance = std::max(0.0, sumSquares / days - schedule.focusMinPerDay * schedule.focusMinPerDay);
+    schedule.focusMinStdErr = std::sqrt(variance / days);
+    schedule.workPerDay = (double)workDoneTotal / days;
+    schedule.pausesPerWork = (double)pausesTotal / std::max(1L, workDoneTotal + abandonedTotal);
+    schedule.abandonedPerDay = (double)abandonedTotal / days;
+}
+
+void candidateSchedules(std::vector<Schedule> &schedules)
+{
+    const int shortBreaks[] = {3, 4, 5, 6, 8, 10};
+    schedules.clear();
+    for (int work = 10; work <= MAX_INTERVAL_MIN; work++)
+        for (size_t s = 0; s < sizeof(shortBreaks) / sizeof(shortBreaks[0]); s++)
+            for (int longBreak = 10; longBreak <= 30; longBreak += 5)
+                for (int n = 2; n <= 6; n++)
+                {
+                    Schedule schedule = {work, shortBreaks[s], longBreak, n, 0, 0, 0, 0, 0};
+                    schedules.push_back(schedule);
+                }
+}
+
+// Evaluate all schedules on threadCt threads, each taking the next
+// unevaluated schedule until none are left.
+void evaluateParallel(const BehaviourModel &model, std::vector<Schedule> &schedules, int threadCt, int days,
+                      unsigned long long dayUs)
+{
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < threadCt; t++)
+    {
+        threads.push_back(std::thread([&]() {
+            for (size_t i = next++; i < schedules.size(); i = next++)
+                evaluate(model, schedules[i], days, dayUs);
+        }));
+    }
+    for (size_t t = 0; t < threads.size(); t++)
+        threads[t].join();
+}
+
+void printModel(const BehaviourModel &model)
+{
+    printf("model pause_samples=%zu resume_after_work_samples=%zu resume_after_break_samples=%zu "
+           "break_pauses_per_h=%.2f abandon_min=%lu abandoning_pauses=%.2f\n",
+           model.pauseMs.size(), model.resumeDelayMs[0].size(), model.resumeDelayMs[1].size(),
+           model.breakRate * 3600000, model.abandonPauseMs / 60000, model.abandonFraction());
+    for (int bucket = 0; bucket < HAZARD_BUCKETS; bucket++)
+        printf("work_min=%d- exposure_min=%.1f pauses=%lu pauses_per_h=%.2f\n", bucket * 5,
+               model.workExposureMs[bucket] / 60000, model.workPauseCts[bucket], model.workRates[bucket] * 3600000);
+}
+
+void printSchedule(const char *label, const Schedule &schedule)
+{
+    printf("%s work=%d short=%d long=%d work_per_long=%d focus_min_per_day=%.1f+-%.1f work_per_day=%.2f "
+           "abandoned_per_day=%.2f pauses_per_work=%.2f\n",
+           label, schedule.workMin, schedule.shortBreakMin, schedule.longBreakMin, schedule.workBeforeLongBreak,
+           schedule.focusMinPerDay, schedule.focusMinStdErr, schedule.workPerDay, schedule.abandonedPerDay,
+           schedule.pausesPerWork);
+}
+
+// Time evaluating the whole grid at doubling thread counts, ending at the
+// core count whether or not it is a power of two.
+int bench(const BehaviourModel &model, int days, unsigned long long dayUs)
+{
+    std::vector<Schedule> schedules;
+    candidateSchedules(schedules);
+    int maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    printf("schedules=%zu days=%d cores=%d\n", schedules.size(), days, maxThreads);
+    for (int threadCt = 1;; threadCt = std::min(threadCt * 2, maxThreads))
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        evaluateParallel(model, schedules, threadCt, days, dayUs);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        printf("threads=%d evaluate_s=%.3f evaluations_per_s=%.0f simulated_days_per_s=%.0f\n", threadCt, seconds,
+               schedules.size() / seconds, schedules.size() * (double)days / seconds);
+        if (threadCt == maxThreads)
+            break;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int threadCt = std::max(1u, std::thread::hardware_concurrency());
+    int days = 64;
+    double dayHours = 8;
+    int top = 10;
+    bool benchmark = false;
+    int traceCt = 0;
+    BehaviourModel model;
+    model.clear();
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+            threadCt = std::max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--days") == 0 && i + 1 < argc)
+            days = std::max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--day-hours") == 0 && i + 1 < argc)
+            dayHours = atof(argv[++i]);
+        else if (strcmp(argv[i], "--top") == 0 && i + 1 < argc)
+            top = std::max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--abandon-min") == 0 && i + 1 < argc)
+            model.abandonPauseMs = std::max(1, atoi(argv[++i])) * 60000UL;
+        else if (strcmp(argv[i], "--bench") == 0)
+            benchmark = true;
+        else if (fitTrace(argv[i], model))
+            traceCt++;
+        else
+        {
+            perror(argv[i]);
+            return 1;
+        }
+    }
+    unsigned long long dayUs = (unsigned long long)(dayHours * 3600e6);
+
+    if (traceCt == 0)
+    {
+        if (!benchmark)
+        {
+            fprintf(stderr, "usage: schedule_optimizer [-j threads] [--days N] [--day-hours N] [--top N] "
+                            "[--abandon-min N] trace.txt...\n       schedule_optimizer --bench [trace.txt...]\n");
+            return 1;
+        }
+        syntheticModel(model);
+    }
+    else
+        model.finish();
+    printModel(model);
+    if (benchmark)
+        return bench(model, days, dayUs);
+
+    std::vector<Schedule> schedules;
+    candidateSchedules(schedules);
+    evaluateParallel(model, schedules, threadCt, days, dayUs);
+
+    Schedule standard = {WORK_SECONDS / 60, SBRK_SECONDS / 60, LBRK_SECONDS / 60, NUM_WORK_BEFORE_LONG_BREAK,
+                         0, 0, 0, 0, 0};
+    evaluate(model, standard, days, dayUs);
+    printSchedule("current", standard);
+
+    std::stable_sort(schedules.begin(), schedules.end(),
+                     [](const Schedule &a, const Schedule &b) { return a.focusMinPerDay > b.focusMinPerDay; });
+    for (int i = 0; i < top && i < (int)schedules.size(); i++)
+    {
+        char label[16];
+        snprintf(label, sizeof(label), "rank%d", i + 1);
+        printSchedule(label, schedules[i]);
+    }
+    return 0;
+}
@@ -0,0 +1,127 @@
+/**
+ * trace_file.h reads the event traces recorded with the 't' serial command,
+ * for the host tools that replay them (replay_trace.cpp) and fit models to
+ * them (schedule_optimizer.cpp). A trace is a snapshot line followed by the
+ * user events and the transitions and pixel bar changes they led to:
+ *   trace <ms> <state> <duration us> <cycle pomos> <pixels> <paused> <on>
+ *   tap|left|right|off|on <ms>
+ *   transition <ms> <state>
+ *   pixels <ms> <state> <pixels>
+ *   dropped <ms> <events lost>
+ * */
+
+#ifndef TRACE_FILE_H
+#define TRACE_FILE_H
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "../pomodoro_timer.h"
+
+// Must match durations[] in pomodoro.cpp; traces are recorded against them.
+const long durations[3] = {WORK_US, SBRK_US, LBRK_US};
+
+// Event kinds, in the order pomodoro.cpp numbers them (TRACE_TAP ...).
+const char *const eventNames[] = {"tap", "left", "right", "off", "on"};
+#define EVENT_TAP 0
+#define EVENT_LEFT 1
+#define EVENT_RIGHT 2
+#define EVENT_OFF 3
+#define EVENT_ON 4
+#define CT_EVENTS 5
+// What the board did in response.
+#define EVENT_TRANSITION 5
+#define EVENT_PIXELS 6
+
+struct TraceEntry
+{
+    unsigned long ms;
+    int type;
+    // New state of a transition or pixel bar change, and the bar length.
+    int state;
+    int pixels;
+};
+
+struct Trace
+{
+    // Snapshot the trace starts from.
+    unsigned long startMs;
+    int state;
+    long duration;
+    int cyclePomoCt;
+    int numPixels;
+    bool paused;
+    bool on;
+
+    // Events and changes in time order.
+    std::vector<TraceEntry> timeline;
+    unsigned long endMs;
+    // Events the board lost to a full queue while recording.
+    unsigned long droppedCt;
+};
+
+inline bool loadTrace(const char *path, Trace &trace)
+{
+    FILE *in = fopen(path, "r");
+    if (!in)
+        return false;
+    // Without a snapshot line the trace starts from a fresh boot.
+    trace.startMs = 0;
+    trace.state = 0;
+    trace.duration = durations[0];
+    trace.cyclePomoCt = 0;
+    trace.numPixels = CT_NEOPIXELS;
+    trace.paused = false;
+    trace.on = true;
+    trace.timeline.clear();
+    trace.endMs = 0;
+    trace.droppedCt = 0;
+
+    char line[256];
+    while (fgets(line, sizeof(line), in))
+    {
+        char word[32];
+        unsigned long ms;
+        if (sscanf(line, "%31s %lu", word, &ms) != 2)
+            continue;
+        if (strcmp(word, "trace") == 0)
+        {
+            int paused, on;
+            if (sscanf(line, "%*s %lu %d %ld %d %d %d %d", &trace.startMs, &trace.state, &trace.duration,
+                       &trace.cyclePomoCt, &trace.numPixels, &paused, &on) == 7)
+            {
+                trace.paused = paused;
+                trace.on = on;
+            }
+            continue;
+        }
+        unsigned long dropped;
+        if (strcmp(word, "dropped") == 0 && sscanf(line, "%*s %*u %lu", &dropped) == 1)
+        {
+            trace.droppedCt += dropped;
+            continue;
+        }
+        TraceEntry entry = {ms, -1, 0, -1};
+        if (strcmp(word, "transition") == 0 && sscanf(line, "%*s %*u %d", &entry.state) == 1)
+            entry.type = EVENT_TRANSITION;
+        else if (strcmp(word, "pixels") == 0 && sscanf(line, "%*s %*u %d %d", &entry.state, &entry.pixels) == 2)
+            entry.type = EVENT_PIXELS;
+        for (int type = 0; type < CT_EVENTS; type++)
+            if (strcmp(word, eventNames[type]) == 0)
+                entry.type = type;
+        if (entry.type < 0)
+            continue;
+        trace.timeline.push_back(entry);
+        trace.endMs = std::max(trace.endMs, ms);
+    }
+    fclose(in);
+
+    // Events are printed whenever loop() drains its queue, so restore time order.
+    std::stable_sort(trace.timeline.begin(), trace.timeline.end(),
+                     [](const TraceEntry &a, const TraceEntry &b) { return a.ms < b.ms; });
+    return true;
+}
+
+#endif